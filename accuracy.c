@@ -0,0 +1,163 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chain.h"
+#include "harness.h"
+#include "reference.h"
+
+// Renders the same inputs through each effect and through its float
+// reference (reference.h) and prints one CSV row per effect and input: how
+// far the fixed-point output is from the reference, and how fast each one
+// ran. Errors are measured in LSBs of the 16-bit output, after both outputs
+// are clipped to 16 bits as main would.
+
+#define ACCURACY_MAX_INPUTS 2
+
+// Harness_run through the reference, in float
+static double accuracy_run_reference(const char *spec,
+                                     const HarnessInput *input,
+                                     unsigned int block_size, int runs,
+                                     float *out) {
+  double best = -1;
+  for (int r = 0; r < runs; r++) {
+    Reference ref;
+    if (Reference_new(&ref, spec) != 0) {
+      Reference_free(&ref);
+      return -1;
+    }
+    for (unsigned int i = 0; i < input->nr_samples; i++) {
+      out[i] = input->samples[i] / 2147483648.0f;
+    }
+    double start = Harness_now();
+    for (unsigned int i = 0; i < input->nr_samples; i += block_size) {
+      unsigned int n = input->nr_samples - i;
+      if (n > block_size) {
+        n = block_size;
+      }
+      Reference_process(&ref, out + i, n);
+    }
+    double elapsed = Harness_now() - start;
+    Reference_free(&ref);
+    if (best < 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+// a sample in LSBs of the 16-bit output, clipped to its range
+static inline double accuracy_lsb(double x) {
+  return x > 32767 ? 32767 : (x < -32768 ? -32768 : x);
+}
+
+/**
+ * SNR of the fixed-point output taking the reference as the signal, and
+ * the largest difference in LSBs. An exact match has an infinite SNR.
+ */
+static void accuracy_compare(const int32_t *fixed, const float *ref,
+                             unsigned int nr_samples, double *snr_db,
+                             double *max_error) {
+  double signal = 0, noise = 0, max = 0;
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    double r = accuracy_lsb(ref[i] * 32768.0);
+    double e = accuracy_lsb(fixed[i] / 65536.0) - r;
+    signal += r * r;
+    noise += e * e;
+    if (fabs(e) > max) {
+      max = fabs(e);
+    }
+  }
+  *snr_db = 10 * log10(signal / noise);
+  *max_error = max;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-f file.wav] [-s seconds] [-n runs] [-b block] "
+          "[effect[:param=value,...]]...\n",
+          prog);
+}
+
+int main(int argc, char *argv[]) {
+  const char *wav_path = "synth_bpm100.wav";
+  float seconds = 10;
+  int runs = 3;
+  unsigned int block_size = 256;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:s:n:b:h")) != -1) {
+    switch (opt) {
+      case 'f':
+        wav_path = optarg;
+        break;
+      case 's':
+        seconds = strtof(optarg, NULL);
+        break;
+      case 'n':
+        runs = atoi(optarg);
+        break;
+      case 'b':
+        block_size = strtoul(optarg, NULL, 10);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (seconds <= 0 || runs < 1 || block_size == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  HarnessInput inputs[ACCURACY_MAX_INPUTS];
+  unsigned int nr_inputs = 0;
+  if (Harness_load_wav(&inputs[nr_inputs], wav_path) == 0) {
+    nr_inputs++;
+  } else {
+    fprintf(stderr, "accuracy: skipping unreadable wav '%s'\n", wav_path);
+  }
+  // 12 dB below full scale, loud without clipping every stage
+  Harness_noise(&inputs[nr_inputs++], seconds * EFFECT_SAMPLE_RATE, 2);
+
+  unsigned int max_samples = Harness_max_samples(inputs, nr_inputs);
+  int32_t *fixed = (int32_t *)Harness_alloc(max_samples, sizeof(int32_t));
+  float *ref = (float *)Harness_alloc(max_samples, sizeof(float));
+
+  // effects given on the command line, otherwise every registered effect
+  const char *specs[HARNESS_MAX_SPECS];
+  unsigned int nr_specs = Harness_specs(argc, argv, optind, specs);
+
+  int result = 0;
+  printf(
+      "effect,input,block_size,samples,snr_db,max_error_lsb,ns_per_sample,"
+      "reference_ns_per_sample\n");
+  for (unsigned int e = 0; e < nr_specs && result == 0; e++) {
+    for (unsigned int i = 0; i < nr_inputs; i++) {
+      double elapsed =
+          Harness_run(specs[e], &inputs[i], block_size, runs, fixed);
+      double ref_elapsed =
+          accuracy_run_reference(specs[e], &inputs[i], block_size, runs, ref);
+      if (elapsed < 0 || ref_elapsed < 0) {
+        result = 1;
+        break;
+      }
+      double snr_db, max_error;
+      accuracy_compare(fixed, ref, inputs[i].nr_samples, &snr_db, &max_error);
+      const char *quote = Harness_quote(specs[e]);
+      printf("%s%s%s,%s,%u,%u,%.2f,%.2f,%.3f,%.3f\n", quote, specs[e], quote,
+             inputs[i].name, block_size, inputs[i].nr_samples, snr_db,
+             max_error, elapsed * 1e9 / inputs[i].nr_samples,
+             ref_elapsed * 1e9 / inputs[i].nr_samples);
+      fflush(stdout);
+    }
+  }
+
+  Harness_free_inputs(inputs, nr_inputs);
+  free(fixed);
+  free(ref);
+  return result;
+}
@@ -0,0 +1,70 @@
+#ifndef ARENA_LIB
+#define ARENA_LIB 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// every allocation starts on its own cache line
+#define ARENA_ALIGN 64
+
+// Bump allocator over one contiguous block. An arena without memory only
+// counts: Arena_alloc returns NULL but still adds up the size, so running
+// the same allocation code against a sizing arena first tells how big the
+// real one has to be.
+typedef struct Arena {
+  uint8_t *base;  // NULL while sizing
+  size_t size;
+  size_t used;
+} Arena;
+
+static inline size_t Arena_round(size_t bytes) {
+  return (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void Arena_sizing(Arena *arena) {
+  arena->base = NULL;
+  arena->size = 0;
+  arena->used = 0;
+}
+
+// uses caller provided memory, which must be ARENA_ALIGN aligned
+void Arena_init(Arena *arena, void *mem, size_t size) {
+  arena->base = (uint8_t *)mem;
+  arena->size = size;
+  arena->used = 0;
+}
+
+// allocates the block from the heap, returns -1 if that fails
+int Arena_malloc(Arena *arena, size_t size) {
+  size = Arena_round(size > 0 ? size : 1);
+  void *mem = aligned_alloc(ARENA_ALIGN, size);
+  if (mem == NULL) {
+    return -1;
+  }
+  Arena_init(arena, mem, size);
+  return 0;
+}
+
+void Arena_free(Arena *arena) {
+  free(arena->base);
+  arena->base = NULL;
+  arena->size = 0;
+  arena->used = 0;
+}
+
+/**
+ * Take zeroed, cache-line aligned memory from the arena.
+ * @return NULL when sizing or when the arena is full.
+ */
+void *Arena_alloc(Arena *arena, size_t bytes) {
+  size_t start = arena->used;
+  arena->used += Arena_round(bytes);
+  if (arena->base == NULL || arena->used > arena->size) {
+    return NULL;
+  }
+  memset(arena->base + start, 0, bytes);
+  return arena->base + start;
+}
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chain.h"
+#include "harness.h"
+
+// Renders a set of inputs through each effect at several block sizes and
+// prints one CSV row per run to stdout.
+
+#define BENCH_MAX_INPUTS 4
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-f file.wav] [-s seconds] [-r rate] [-n runs] "
+          "[-b block,...] [effect[:param=value,...]]...\n",
+          prog);
+}
+
+int main(int argc, char *argv[]) {
+  const char *wav_path = "synth_bpm100.wav";
+  float seconds = 10;
+  unsigned int sample_rate = 44100;
+  int runs = 3;
+  char blocks_arg[CHAIN_MAX_SPEC] = "16,64,256,1024,8192";
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:s:r:n:b:h")) != -1) {
+    switch (opt) {
+      case 'f':
+        wav_path = optarg;
+        break;
+      case 's':
+        seconds = strtof(optarg, NULL);
+        break;
+      case 'r':
+        sample_rate = strtoul(optarg, NULL, 10);
+        break;
+      case 'n':
+        runs = atoi(optarg);
+        break;
+      case 'b':
+        snprintf(blocks_arg, sizeof(blocks_arg), "%s", optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (seconds <= 0 || sample_rate == 0 || runs < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  unsigned int block_sizes[16];
+  unsigned int nr_block_sizes = 0;
+  for (char *tok = strtok(blocks_arg, ","); tok != NULL && nr_block_sizes < 16;
+       tok = strtok(NULL, ",")) {
+    unsigned int b = strtoul(tok, NULL, 10);
+    if (b > 0) {
+      block_sizes[nr_block_sizes++] = b;
+    }
+  }
+
+  HarnessInput inputs[BENCH_MAX_INPUTS];
+  unsigned int nr_inputs = 0;
+  unsigned int nr_synthetic = seconds * sample_rate;
+  if (Harness_load_wav(&inputs[nr_inputs], wav_path) == 0) {
+    nr_inputs++;
+  } else {
+    fprintf(stderr, "bench: skipping unreadable wav '%s'\n", wav_path);
+  }
+  Harness_noise(&inputs[nr_inputs++], nr_synthetic, 0);
+  Harness_impulse(&inputs[nr_inputs++], nr_synthetic);
+  Harness_silence(&inputs[nr_inputs++], nr_synthetic);
+
+  int32_t *work = (int32_t *)Harness_alloc(
+      Harness_max_samples(inputs, nr_inputs), sizeof(int32_t));
+
+  // effects given on the command line, otherwise every registered effect
+  const char *specs[HARNESS_MAX_SPECS];
+  unsigned int nr_specs = Harness_specs(argc, argv, optind, specs);
+
+  printf(
+      "effect,input,block_size,samples,ns_per_sample,realtime_factor,"
+      "instances_per_core\n");
+  for (unsigned int e = 0; e < nr_specs; e++) {
+    for (unsigned int i = 0; i < nr_inputs; i++) {
+      for (unsigned int b = 0; b < nr_block_sizes; b++) {
+        double elapsed =
+            Harness_run(specs[e], &inputs[i], block_sizes[b], runs, work);
+        if (elapsed < 0) {
+          free(work);
+          return 1;
+        }
+        double ns_per_sample = elapsed * 1e9 / inputs[i].nr_samples;
+        double realtime_factor = 1e9 / (ns_per_sample * sample_rate);
+        const char *quote = Harness_quote(specs[e]);
+        printf("%s%s%s,%s,%u,%u,%.3f,%.2f,%u\n", quote, specs[e], quote,
+               inputs[i].name, block_sizes[b], inputs[i].nr_samples,
+               ns_per_sample, realtime_factor, (unsigned int)realtime_factor);
+        fflush(stdout);
+      }
+    }
+  }
+
+  Harness_free_inputs(inputs, nr_inputs);
+  free(work);
+  return 0;
+}
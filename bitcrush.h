@@ -1,34 +1,128 @@
 #ifndef BITCRUSH_LIB
 #define BITCRUSH_LIB 1
 
+#include "arena.h"
+#include "effect.h"
 #include "fixedpoint.h"
 
+// Bit depth and sample rate reduction. The samples are quantized a block at
+// a time, then held: a Q16.16 countdown to the next sample to take is
+// carried across blocks, so the output does not depend on the block size
+// and the rate can be fractional.
 typedef struct Bitcrush {
-  uint8_t bits;
-  uint8_t reduce;
+  uint8_t bits;       // bits of the int16 output that are kept
+  int32_t mask;       // keeps those bits of a Q16.16 sample
+  int32_t reduce;     // Q16.16 samples each taken sample is held for, >= 1
+  int32_t countdown;  // Q16.16 samples until the next one is taken
+  int32_t held;       // the sample being held
 } Bitcrush;
 
+// 1..16 bits, 16 leaves int16 samples as they are
+void Bitcrush_set_bits(Bitcrush *bitcrush, unsigned int bits) {
+  bitcrush->bits = (uint8_t)bits;
+  bitcrush->mask = (int32_t)(UINT32_MAX << (32 - bits));
+}
+
+// the rate is divided by reduce >= 1, which need not be a whole number
+void Bitcrush_set_reduce(Bitcrush *bitcrush, float reduce) {
+  bitcrush->reduce = q16_16_float_to_fp(reduce);
+  // a faster rate takes effect right away
+  if (bitcrush->countdown > bitcrush->reduce) {
+    bitcrush->countdown = bitcrush->reduce;
+  }
+}
+
+static void Bitcrush_init(Bitcrush *bitcrush) {
+  bitcrush->countdown = 0;
+  bitcrush->held = 0;
+  Bitcrush_set_bits(bitcrush, 8);
+  Bitcrush_set_reduce(bitcrush, 5);
+}
+
+Bitcrush *Bitcrush_alloc(Arena *arena) {
+  Bitcrush *bitcrush = (Bitcrush *)Arena_alloc(arena, sizeof(Bitcrush));
+  if (bitcrush == NULL) {
+    return NULL;
+  }
+  Bitcrush_init(bitcrush);
+  return bitcrush;
+}
+
 Bitcrush *Bitcrush_malloc() {
   Bitcrush *bitcrush = (Bitcrush *)malloc(sizeof(Bitcrush));
   if (bitcrush == NULL) {
     return NULL;
   }
-  bitcrush->bits = 8;
-  bitcrush->reduce = 5;
-
+  Bitcrush_init(bitcrush);
   return bitcrush;
 }
 
 void Bitcrush_process(Bitcrush *bitcrush, int32_t *buf,
                       unsigned int nr_samples) {
-  for (int i = 0; i < nr_samples; i++) {
-    if (i % bitcrush->reduce == 0) {
-      // bitcrush fixedpoint
-      buf[i] = buf[i] >> (16 - bitcrush->bits) << (16 - bitcrush->bits);
-    } else {
-      buf[i] = buf[i - 1];
+  q16_16_and_block(buf, bitcrush->mask, nr_samples);
+  if (bitcrush->reduce == Q16_16_1 && bitcrush->countdown <= 0) {
+    // every sample is taken, the countdown never goes up
+    if (nr_samples > 0) {
+      bitcrush->held = buf[nr_samples - 1];
+    }
+    return;
+  }
+
+  int32_t reduce = bitcrush->reduce;
+  int32_t countdown = bitcrush->countdown;
+  int32_t held = bitcrush->held;
+  for (unsigned int i = 0; i < nr_samples;) {
+    if (countdown <= 0) {
+      held = buf[i];
+      countdown += reduce;
+    }
+    // the held sample covers every sample until the countdown runs out
+    unsigned int run = (unsigned int)(countdown + Q16_16_1 - 1) >> 16;
+    if (run > nr_samples - i) {
+      run = nr_samples - i;
+    }
+    for (unsigned int k = 0; k < run; k++) {
+      buf[i + k] = held;
     }
+    countdown -= (int32_t)(run << 16);
+    i += run;
   }
+  bitcrush->countdown = countdown;
+  bitcrush->held = held;
+}
+
+void Bitcrush_reset(Bitcrush *bitcrush) {
+  bitcrush->countdown = 0;
+  bitcrush->held = 0;
+}
+
+int Bitcrush_set_param(Bitcrush *bitcrush, const char *param, float value) {
+  if (strcmp(param, "bits") == 0 && value >= 1 && value <= 16) {
+    Bitcrush_set_bits(bitcrush, (unsigned int)value);
+    return 0;
+  }
+  if (strcmp(param, "reduce") == 0 && value >= 1 && value <= 4096) {
+    Bitcrush_set_reduce(bitcrush, value);
+    return 0;
+  }
+  return -1;
+}
+
+// a sample is held for at most ceil(reduce) samples
+uint32_t Bitcrush_tail(Bitcrush *bitcrush) {
+  return (uint32_t)(bitcrush->reduce + Q16_16_1 - 1) >> 16;
+}
+
+// runs the countdown n samples on, taking the fewest samples that keep it
+// above -1, as Bitcrush_process would
+void Bitcrush_advance(Bitcrush *bitcrush, uint32_t n) {
+  int64_t elapsed = (int64_t)n << 16;
+  int64_t countdown = bitcrush->countdown - elapsed;
+  int64_t behind = elapsed - Q16_16_1 - bitcrush->countdown;
+  if (behind >= 0) {
+    countdown += (behind / bitcrush->reduce + 1) * bitcrush->reduce;
+  }
+  bitcrush->countdown = (int32_t)countdown;
 }
 
 void Bitcrush_free(Bitcrush *bitcrush) {
@@ -37,4 +131,31 @@ void Bitcrush_free(Bitcrush *bitcrush) {
   }
 }
 
+static void Bitcrush_effect_process(void *self, int32_t *buf,
+                                    unsigned int nr_samples) {
+  Bitcrush_process((Bitcrush *)self, buf, nr_samples);
+}
+
+static int Bitcrush_effect_set_param(void *self, const char *param,
+                                     float value) {
+  return Bitcrush_set_param((Bitcrush *)self, param, value);
+}
+
+static void Bitcrush_effect_reset(void *self) {
+  Bitcrush_reset((Bitcrush *)self);
+}
+
+static uint32_t Bitcrush_effect_tail(void *self) {
+  return Bitcrush_tail((Bitcrush *)self);
+}
+
+static void Bitcrush_effect_advance(void *self, uint32_t n) {
+  Bitcrush_advance((Bitcrush *)self, n);
+}
+
+const EffectOps Bitcrush_ops = {"bitcrush", Bitcrush_effect_process,
+                                Bitcrush_effect_set_param,
+                                Bitcrush_effect_reset, Bitcrush_effect_tail,
+                                Bitcrush_effect_advance};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,422 @@
+#ifndef CHAIN_LIB
+#define CHAIN_LIB 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "bitcrush.h"
+#include "delay.h"
+#include "effect.h"
+#include "flanger.h"
+#include "freeverb_fp.h"
+#include "monitor.h"
+#include "multitapdelay.h"
+#include "reverb.h"
+#include "tapedelay.h"
+#include "telemetry.h"
+
+#define CHAIN_MAX_EFFECTS 16
+#define CHAIN_MAX_SPEC 256
+
+// All effects of a chain and their delay lines live in one arena, a chain
+// makes no allocations once it is built.
+typedef struct Chain {
+  Effect effects[CHAIN_MAX_EFFECTS];
+  unsigned int nr_effects;
+  Arena arena;
+  int owns_arena;  // set when Chain_parse allocated the arena
+  Monitor *monitor;  // times every block when set
+#ifdef FPFX_TELEMETRY
+  TelemetryCounters telemetry[CHAIN_MAX_EFFECTS];
+#endif
+} Chain;
+
+/**
+ * The value a spec's parameter list, "param=value,...", gives a parameter,
+ * the last one wins as when the parameters are applied.
+ * @return 1 if it is given with a number, 0 otherwise.
+ */
+static int Chain_find_param(const char *params, const char *param,
+                            float *value) {
+  size_t len = strlen(param);
+  int found = 0;
+  while (params != NULL && *params != '\0') {
+    if (strncmp(params, param, len) == 0 && params[len] == '=') {
+      char *end;
+      float v = strtof(params + len + 1, &end);
+      if (end != params + len + 1 && (*end == ',' || *end == '\0')) {
+        *value = v;
+        found = 1;
+      }
+    }
+    params = strchr(params, ',');
+    if (params != NULL) {
+      params++;
+    }
+  }
+  return found;
+}
+
+// constructors using the defaults each effect had in main.c, with a sizing
+// arena they only count and return NULL. They get the spec's parameters for
+// anything that has to be known before the effect is placed in the arena.
+
+/*
+ * The delay line is max or max_ms long, up to DELAY_MAX_MS. Without either
+ * it is just long enough for the default time or the time the spec sets.
+ */
+static void *Chain_new_delay(Arena *arena, const char *params) {
+  float max = DELAY_DEFAULT_TIME;
+  float value, bpm, beats = 1;
+  if (Chain_find_param(params, "max", &value)) {
+    max = value;
+  } else if (Chain_find_param(params, "max_ms", &value)) {
+    max = Delay_ms_to_samples(value);
+  } else {
+    if (Chain_find_param(params, "time", &value) && value > max) {
+      max = value;
+    }
+    if (Chain_find_param(params, "ms", &value) &&
+        Delay_ms_to_samples(value) > max) {
+      max = Delay_ms_to_samples(value);
+    }
+    // bpm may be applied before beats, at the default of 1 beat
+    if (Chain_find_param(params, "beats", &value) && value > beats) {
+      beats = value;
+    }
+    if (Chain_find_param(params, "bpm", &bpm) && bpm > 0 &&
+        Delay_bpm_to_samples(bpm, beats) > max) {
+      max = Delay_bpm_to_samples(bpm, beats);
+    }
+  }
+  // out of range lengths are caught when the parameters are applied
+  unsigned int longest = DELAY_MAX_MS * EFFECT_SAMPLE_RATE / 1000;
+  unsigned int max_delay =
+      max >= 0.5f && max < longest ? (unsigned int)(max + 0.5f) : longest;
+  Delay *delay = Delay_alloc(arena, 0.6, max_delay);
+  if (delay != NULL && max_delay >= DELAY_DEFAULT_TIME) {
+    Delay_set_time(delay, DELAY_DEFAULT_TIME);
+  }
+  return delay;
+}
+
+static void *Chain_new_reverb(Arena *arena, const char *params) {
+  return Reverb_alloc(arena);
+}
+
+static void *Chain_new_bitcrush(Arena *arena, const char *params) {
+  return Bitcrush_alloc(arena);
+}
+
+static void *Chain_new_flanger(Arena *arena, const char *params) {
+  return Flanger_alloc(arena, 0.2);
+}
+
+static void *Chain_new_freeverb(Arena *arena, const char *params) {
+  return FV_Reverb_alloc(arena, FV_MONO);
+}
+
+static void *Chain_new_multitap(Arena *arena, const char *params) {
+  MultiTapDelay *multitap = MultiTapDelay_alloc(arena, 32766);
+  if (multitap != NULL) {
+    MultiTapDelay_set_tap(multitap, 0, 5512.5, 0.7);
+    MultiTapDelay_set_tap(multitap, 1, 11025, 0.5);
+    MultiTapDelay_set_tap(multitap, 2, 16537.5, 0.35);
+    MultiTapDelay_set_feedback(multitap, 0.3);
+  }
+  return multitap;
+}
+
+static void *Chain_new_tapedelay(Arena *arena, const char *params) {
+  TapeDelay *tapedelay = TapeDelay_alloc(arena, 0.89, 15000);
+  if (tapedelay != NULL) {
+    TapeDelay_set_feedback(tapedelay, 0.9);
+  }
+  return tapedelay;
+}
+
+typedef struct ChainEntry {
+  const EffectOps *ops;
+  void *(*create)(Arena *arena, const char *params);
+} ChainEntry;
+
+const ChainEntry Chain_registry[] = {
+    {&Delay_ops, Chain_new_delay},
+    {&Reverb_ops, Chain_new_reverb},
+    {&Bitcrush_ops, Chain_new_bitcrush},
+    {&Flanger_ops, Chain_new_flanger},
+    {&FV_Reverb_ops, Chain_new_freeverb},
+    {&TapeDelay_ops, Chain_new_tapedelay},
+    {&MultiTapDelay_ops, Chain_new_multitap},
+};
+
+#define CHAIN_REGISTRY_SIZE (sizeof(Chain_registry) / sizeof(Chain_registry[0]))
+
+void Chain_init(Chain *chain) {
+  chain->nr_effects = 0;
+  Arena_sizing(&chain->arena);
+  chain->owns_arena = 0;
+  chain->monitor = NULL;
+#ifdef FPFX_TELEMETRY
+  memset(chain->telemetry, 0, sizeof(chain->telemetry));
+#endif
+}
+
+const ChainEntry *Chain_lookup(const char *name) {
+  for (unsigned int i = 0; i < CHAIN_REGISTRY_SIZE; i++) {
+    if (strcmp(Chain_registry[i].ops->name, name) == 0) {
+      return &Chain_registry[i];
+    }
+  }
+  return NULL;
+}
+
+// copies the spec into name and splits off the parameters, if any
+static const ChainEntry *Chain_split(const char *spec, char *name,
+                                     char **params) {
+  if (strlen(spec) >= CHAIN_MAX_SPEC) {
+    fprintf(stderr, "chain: spec too long: %s\n", spec);
+    return NULL;
+  }
+  strcpy(name, spec);
+
+  *params = strchr(name, ':');
+  if (*params != NULL) {
+    *(*params)++ = '\0';
+  }
+
+  const ChainEntry *entry = Chain_lookup(name);
+  if (entry == NULL) {
+    fprintf(stderr, "chain: unknown effect '%s'\n", name);
+  }
+  return entry;
+}
+
+/**
+ * Apply the parameters of a spec, "param=value,...", through set_param.
+ * @param name Effect name for the error message.
+ * @param params Cut up in place, NULL for none.
+ * @return 0 on success, -1 on a malformed or rejected parameter.
+ */
+int Chain_set_params(void *self,
+                     int (*set_param)(void *self, const char *param,
+                                      float value),
+                     const char *name, char *params) {
+  while (params != NULL && *params != '\0') {
+    char *next = strchr(params, ',');
+    if (next != NULL) {
+      *next++ = '\0';
+    }
+    char *value = strchr(params, '=');
+    char *end = NULL;
+    float v = 0;
+    if (value != NULL) {
+      *value++ = '\0';
+      v = strtof(value, &end);
+    }
+    if (value == NULL || end == value || *end != '\0' ||
+        set_param(self, params, v) != 0) {
+      fprintf(stderr, "chain: bad parameter '%s' for '%s'\n", params, name);
+      return -1;
+    }
+    params = next;
+  }
+  return 0;
+}
+
+/**
+ * Bytes of arena a chain built from these specs needs.
+ * @return 0 on success, -1 on an unknown effect.
+ */
+int Chain_size(int nr_specs, char **specs, size_t *size) {
+  char name[CHAIN_MAX_SPEC];
+  char *params;
+  Arena arena;
+  Arena_sizing(&arena);
+  for (int i = 0; i < nr_specs; i++) {
+    const ChainEntry *entry = Chain_split(specs[i], name, &params);
+    if (entry == NULL) {
+      return -1;
+    }
+    entry->create(&arena, params);
+  }
+  *size = arena.used;
+  return 0;
+}
+
+/**
+ * Append an effect to the chain, placing it in the chain's arena.
+ * @param chain Pointer to the Chain instance.
+ * @param spec Effect name optionally followed by parameters, e.g.
+ *             "tapedelay:feedback=0.5,time=12000".
+ * @return 0 on success, -1 on an unknown effect or parameter or when the
+ *         arena is full.
+ */
+int Chain_add(Chain *chain, const char *spec) {
+  char name[CHAIN_MAX_SPEC];
+  char *params;
+  if (chain->nr_effects == CHAIN_MAX_EFFECTS) {
+    fprintf(stderr, "chain: too many effects (max %d)\n", CHAIN_MAX_EFFECTS);
+    return -1;
+  }
+  const ChainEntry *entry = Chain_split(spec, name, &params);
+  if (entry == NULL) {
+    return -1;
+  }
+
+  Effect effect = {entry->ops, entry->create(&chain->arena, params)};
+  if (effect.self == NULL) {
+    fprintf(stderr, "chain: no room in the arena for '%s'\n", name);
+    return -1;
+  }
+
+  if (Chain_set_params(effect.self, entry->ops->set_param, name, params) !=
+      0) {
+    return -1;
+  }
+
+  chain->effects[chain->nr_effects++] = effect;
+  return 0;
+}
+
+/**
+ * Build the chain from a list of specs, in order, inside memory provided by
+ * the caller. Lets many chains share one block, see Chain_size.
+ * @param mem ARENA_ALIGN aligned memory of at least size bytes.
+ */
+int Chain_parse_in(Chain *chain, void *mem, size_t size, int nr_specs,
+                   char **specs) {
+  Arena_init(&chain->arena, mem, size);
+  for (int i = 0; i < nr_specs; i++) {
+    if (Chain_add(chain, specs[i]) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Build the chain again from the same specs in its own arena, leaving it as
+ * Chain_parse did. Unlike Chain_reset this restores what the effects only
+ * set up on construction, like the slews gliding in. The monitor and the
+ * telemetry counts are kept.
+ */
+int Chain_rebuild(Chain *chain, int nr_specs, char **specs) {
+  chain->nr_effects = 0;
+  return Chain_parse_in(chain, chain->arena.base, chain->arena.size, nr_specs,
+                        specs);
+}
+
+// Builds the chain from a list of specs, in order, in a single allocation.
+int Chain_parse(Chain *chain, int nr_specs, char **specs) {
+  size_t size;
+  if (Chain_size(nr_specs, specs, &size) != 0) {
+    return -1;
+  }
+  Arena arena;
+  if (Arena_malloc(&arena, size) != 0) {
+    fprintf(stderr, "chain: could not allocate %zu bytes\n", size);
+    return -1;
+  }
+  chain->owns_arena = 1;
+  return Chain_parse_in(chain, arena.base, arena.size, nr_specs, specs);
+}
+
+// Attaches a monitor, several chains running the same specs may share one.
+void Chain_set_monitor(Chain *chain, Monitor *monitor) {
+  chain->monitor = monitor;
+  for (unsigned int i = 0; monitor != NULL && i < chain->nr_effects; i++) {
+    Monitor_set_effect(monitor, i, chain->effects[i].ops->name);
+  }
+}
+
+static void Chain_process_monitored(Chain *chain, int32_t *buf,
+                                    unsigned int nr_samples) {
+  uint64_t start = Monitor_now_ns();
+  uint64_t t = start;
+  for (unsigned int i = 0; i < chain->nr_effects; i++) {
+    Effect_process(&chain->effects[i], buf, nr_samples);
+    uint64_t now = Monitor_now_ns();
+    Monitor_effect(chain->monitor, i, now - t);
+    t = now;
+  }
+  Monitor_block(chain->monitor, nr_samples, t - start);
+}
+
+#ifdef FPFX_TELEMETRY
+// every effect counts into its own slot and its output is scanned for peaks
+static void Chain_process_counted(Chain *chain, int32_t *buf,
+                                  unsigned int nr_samples) {
+  for (unsigned int i = 0; i < chain->nr_effects; i++) {
+    TelemetryCounters *t = &chain->telemetry[i];
+    uint64_t before = Telemetry_events(t);
+    Telemetry_current = t;
+    Effect_process(&chain->effects[i], buf, nr_samples);
+    Telemetry_scan(t, buf, nr_samples);
+    t->blocks++;
+    t->bad_blocks += Telemetry_events(t) != before;
+  }
+  Telemetry_current = &Telemetry_sink;
+}
+
+// one line per effect, with the counts of all chains given
+void Chain_telemetry_dump(Chain *chains, unsigned int nr_chains, FILE *f) {
+  for (unsigned int i = 0; nr_chains > 0 && i < chains[0].nr_effects; i++) {
+    TelemetryCounters total;
+    memset(&total, 0, sizeof(total));
+    for (unsigned int c = 0; c < nr_chains; c++) {
+      Telemetry_merge(&total, &chains[c].telemetry[i]);
+    }
+    Telemetry_print(f, chains[0].effects[i].ops->name, &total);
+  }
+}
+#endif
+
+void Chain_process(Chain *chain, int32_t *buf, unsigned int nr_samples) {
+#ifdef FPFX_TELEMETRY
+  // the counting build is too slow for its timings to mean anything
+  Chain_process_counted(chain, buf, nr_samples);
+  return;
+#endif
+  if (chain->monitor != NULL) {
+    Chain_process_monitored(chain, buf, nr_samples);
+    return;
+  }
+  for (unsigned int i = 0; i < chain->nr_effects; i++) {
+    Effect_process(&chain->effects[i], buf, nr_samples);
+  }
+}
+
+void Chain_reset(Chain *chain) {
+  for (unsigned int i = 0; i < chain->nr_effects; i++) {
+    Effect_reset(&chain->effects[i]);
+  }
+}
+
+// samples an input keeps ringing through the whole chain
+uint32_t Chain_tail(Chain *chain) {
+  uint32_t tail = 0;
+  for (unsigned int i = 0; i < chain->nr_effects; i++) {
+    tail = Effect_tail_add(tail, Effect_tail(&chain->effects[i]));
+  }
+  return tail;
+}
+
+// moves the time based state of every effect n samples ahead
+void Chain_advance(Chain *chain, uint32_t n) {
+  for (unsigned int i = 0; i < chain->nr_effects; i++) {
+    Effect_advance(&chain->effects[i], n);
+  }
+}
+
+// the effects live in the arena, so they are released all at once
+void Chain_free(Chain *chain) {
+  if (chain->owns_arena) {
+    Arena_free(&chain->arena);
+  }
+  Chain_init(chain);
+}
+
+#endif
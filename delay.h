@@ -1,49 +1,190 @@
 #ifndef Delay_LIB
 #define Delay_LIB 1
 
+#include "effect.h"
 #include "fixedpoint.h"
 #include "ringbuffer.h"
 
+// longest delay line a chain's delay can be created with, 2 seconds
+#define DELAY_MAX_MS 2000
+// delay a chain's delay starts at, in samples
+#define DELAY_DEFAULT_TIME (13230 / 2)
+
+// fractional bits of the feedback, see FIXEDPOINT_Q_BITS
+#ifndef DELAY_Q_BITS
+#define DELAY_Q_BITS FIXEDPOINT_Q_BITS
+#endif
+
 typedef struct Delay {
-  Ringbuffer *fb0;
-  int32_t feedback;
+  Ringbuffer *fb0;  // holds the longest delay the Delay was created with
+  unsigned int time;  // delay in samples, 1 <= time <= fb0->nr_samples
+  int32_t feedback;  // DELAY_Q_BITS fractional bits
+  float bpm;  // tempo the delay follows once set, 0 for none
+  float beats;  // delay in beats of the tempo
 } Delay;
 
-Delay *Delay_malloc(float feedback) {
-  Delay *delay = (Delay *)malloc(sizeof(Delay));
-  if (delay == NULL) {
+/**
+ * Places the delay and its delay line in the arena, the delay starts at its
+ * longest.
+ * @param max_delay Longest delay in samples, it can't be changed later.
+ */
+Delay *Delay_alloc(Arena *arena, float feedback, unsigned int max_delay) {
+  Delay *delay = (Delay *)Arena_alloc(arena, sizeof(Delay));
+  Ringbuffer *fb0 = Ringbuffer_alloc(arena, max_delay);
+  if (delay == NULL || fb0 == NULL) {
     return NULL;
   }
-  delay->feedback = q16_16_float_to_fp(feedback);
-  delay->fb0 = Ringbuffer_malloc(13230 / 2);
+  delay->feedback = q_float_to_fp(feedback, DELAY_Q_BITS);
+  delay->fb0 = fb0;
+  delay->time = max_delay;
+  delay->bpm = 0;
+  delay->beats = 1;
+  return delay;
+}
 
-  if (!delay->fb0) {
-    Ringbuffer_free(delay->fb0);
-    free(delay);
+// a single heap block, the Delay comes first in it
+Delay *Delay_malloc(float feedback, unsigned int max_delay) {
+  Arena arena;
+  Arena_sizing(&arena);
+  Delay_alloc(&arena, feedback, max_delay);
+  if (Arena_malloc(&arena, arena.used) != 0) {
     return NULL;
   }
-
-  return delay;
+  return Delay_alloc(&arena, feedback, max_delay);
 }
 
 void Delay_set_feedback(Delay *delay, float feedback) {
-  delay->feedback = q16_16_float_to_fp(feedback);
+  delay->feedback = q_float_to_fp(feedback, DELAY_Q_BITS);
+}
+
+/**
+ * Set the delay, rounded to a whole sample. The line is read from a new
+ * place right away, there is no glide.
+ * @return 0 on success, -1 if it is shorter than a sample or longer than
+ * the delay was created with.
+ */
+int Delay_set_time(Delay *delay, float samples) {
+  if (!(samples >= 0.5f) || samples >= delay->fb0->nr_samples + 0.5f) {
+    return -1;
+  }
+  delay->time = (unsigned int)(samples + 0.5f);
+  return 0;
+}
+
+static inline float Delay_ms_to_samples(float ms) {
+  return ms * EFFECT_SAMPLE_RATE / 1000.0f;
+}
+
+// a note length at a tempo in samples, see Delay_set_time_bpm
+static inline float Delay_bpm_to_samples(float bpm, float beats) {
+  return beats * 60.0f * EFFECT_SAMPLE_RATE / bpm;
+}
+
+int Delay_set_time_ms(Delay *delay, float ms) {
+  return Delay_set_time(delay, Delay_ms_to_samples(ms));
+}
+
+/**
+ * Set the delay to a note length at a tempo.
+ * @param beats Length in quarter notes, e.g. 0.75 for a dotted eighth or
+ * 1/3.0 for an eighth note triplet.
+ */
+int Delay_set_time_bpm(Delay *delay, float bpm, float beats) {
+  if (!(bpm > 0)) {
+    return -1;
+  }
+  return Delay_set_time(delay, Delay_bpm_to_samples(bpm, beats));
 }
 
 void Delay_process(Delay *delay, int32_t *buf, unsigned int nr_samples) {
-  for (int i = 0; i < nr_samples; i++) {
-    int32_t x = buf[i];
-    x += q16_16_multiply(delay->feedback, Ringbuffer_get(delay->fb0));
-    Ringbuffer_add(delay->fb0, x);
-    buf[i] = x;
+  // whole spans at a time, at most one delay length so nothing written in a
+  // pass is read back in the same pass. A delay at least as long as the
+  // block takes it in a single pass.
+  for (unsigned int i = 0; i < nr_samples;) {
+    unsigned int n = nr_samples - i;
+    if (n > delay->time) {
+      n = delay->time;
+    }
+    Ringbuffer_tap_mac_sat(delay->fb0, delay->time, buf + i, delay->feedback,
+                           DELAY_Q_BITS, n);
+    Ringbuffer_write(delay->fb0, buf + i, n);
+    i += n;
   }
 }
 
-void Delay_free(Delay *delay) {
-  if (delay != NULL) {
-    Ringbuffer_free(delay->fb0);
-    free(delay);
+void Delay_reset(Delay *delay) { Ringbuffer_clear(delay->fb0); }
+
+/**
+ * Parameters: feedback, time in samples, ms, or bpm with beats. max and
+ * max_ms, the length of the delay line, can only be chosen at creation
+ * (see Chain_new_delay) and are accepted when they match it.
+ */
+int Delay_set_param(Delay *delay, const char *param, float value) {
+  if (strcmp(param, "max") == 0 || strcmp(param, "max_ms") == 0) {
+    float samples = param[3] == '\0' ? value : Delay_ms_to_samples(value);
+    if (!(samples >= 0.5f) || samples >= delay->fb0->nr_samples + 0.5f) {
+      return -1;
+    }
+    return (unsigned int)(samples + 0.5f) == delay->fb0->nr_samples ? 0 : -1;
   }
+  if (strcmp(param, "feedback") == 0) {
+    Delay_set_feedback(delay, value);
+    return 0;
+  }
+  if (strcmp(param, "time") == 0) {
+    return Delay_set_time(delay, value);
+  }
+  if (strcmp(param, "ms") == 0) {
+    return Delay_set_time_ms(delay, value);
+  }
+  // either one can come first, the time follows once the tempo is known
+  if (strcmp(param, "bpm") == 0 && value > 0) {
+    if (Delay_set_time_bpm(delay, value, delay->beats) != 0) {
+      return -1;
+    }
+    delay->bpm = value;
+    return 0;
+  }
+  if (strcmp(param, "beats") == 0 && value > 0) {
+    if (delay->bpm > 0 && Delay_set_time_bpm(delay, delay->bpm, value) != 0) {
+      return -1;
+    }
+    delay->beats = value;
+    return 0;
+  }
+  return -1;
+}
+
+// every pass through the line scales an input by the feedback
+uint32_t Delay_tail(Delay *delay) {
+  return Effect_feedback_tail(delay->time, delay->feedback, DELAY_Q_BITS,
+                              EFFECT_TAIL_BITS);
+}
+
+void Delay_free(Delay *delay) {
+  free(delay);
 }
 
+static void Delay_effect_process(void *self, int32_t *buf,
+                                 unsigned int nr_samples) {
+  Delay_process((Delay *)self, buf, nr_samples);
+}
+
+static int Delay_effect_set_param(void *self, const char *param, float value) {
+  return Delay_set_param((Delay *)self, param, value);
+}
+
+static void Delay_effect_reset(void *self) { Delay_reset((Delay *)self); }
+
+static uint32_t Delay_effect_tail(void *self) {
+  return Delay_tail((Delay *)self);
+}
+
+// the delay has no time based state
+static void Delay_effect_advance(void *self, uint32_t n) {}
+
+const EffectOps Delay_ops = {"delay", Delay_effect_process,
+                             Delay_effect_set_param, Delay_effect_reset,
+                             Delay_effect_tail, Delay_effect_advance};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,93 @@
+#ifndef EFFECT_LIB
+#define EFFECT_LIB 1
+
+#include <stdint.h>
+#include <string.h>
+
+// sample rate that time based parameters (milliseconds) are converted at
+#define EFFECT_SAMPLE_RATE 44100
+
+// tail of an effect whose input can keep ringing forever
+#define EFFECT_TAIL_UNBOUNDED UINT32_MAX
+// an input has died out once it is below 1 LSB of a 16-bit output
+#define EFFECT_TAIL_BITS 16
+
+// Common interface implemented by every effect so that chains can be
+// assembled at runtime. Effects are always driven a whole block at a time,
+// the only indirection is one call per effect per block. The interface does
+// not free effects: a chain's effects live in its arena and go with it, the
+// *_malloc constructors pair with their own *_free.
+typedef struct EffectOps {
+  const char *name;
+  void (*process)(void *self, int32_t *buf, unsigned int nr_samples);
+  // returns 0 on success, -1 if the parameter is unknown
+  int (*set_param)(void *self, const char *param, float value);
+  // clears all audio state (delay lines, filters) but keeps the parameters
+  void (*reset)(void *self);
+  // samples after which an input no longer reaches the output, or
+  // EFFECT_TAIL_UNBOUNDED, so rendering can start mid-file after a pre-roll
+  uint32_t (*tail)(void *self);
+  // moves time based state (LFO phase, parameter ramps) n samples ahead as
+  // if n samples had been processed, the audio state is left alone
+  void (*advance)(void *self, uint32_t n);
+} EffectOps;
+
+typedef struct Effect {
+  const EffectOps *ops;
+  void *self;
+} Effect;
+
+static inline void Effect_process(Effect *effect, int32_t *buf,
+                                  unsigned int nr_samples) {
+  effect->ops->process(effect->self, buf, nr_samples);
+}
+
+static inline int Effect_set_param(Effect *effect, const char *param,
+                                   float value) {
+  return effect->ops->set_param(effect->self, param, value);
+}
+
+static inline void Effect_reset(Effect *effect) {
+  effect->ops->reset(effect->self);
+}
+
+static inline uint32_t Effect_tail(Effect *effect) {
+  return effect->ops->tail(effect->self);
+}
+
+static inline void Effect_advance(Effect *effect, uint32_t n) {
+  effect->ops->advance(effect->self, n);
+}
+
+// tail of two stages in series
+static inline uint32_t Effect_tail_add(uint32_t a, uint32_t b) {
+  return b < EFFECT_TAIL_UNBOUNDED - a ? a + b : EFFECT_TAIL_UNBOUNDED;
+}
+
+/**
+ * Tail of a feedback loop: the loop length times the number of passes until
+ * the loop gain has decayed an input below 2^-bits.
+ * @param gain_bits Fractional bits of the gain, 16 for Q16.16.
+ * @param bits EFFECT_TAIL_BITS, plus headroom for any gain after the loop.
+ * @return EFFECT_TAIL_UNBOUNDED if the loop never decays.
+ */
+static inline uint32_t Effect_feedback_tail(uint32_t loop_length,
+                                            int32_t gain,
+                                            unsigned int gain_bits,
+                                            unsigned int bits) {
+  int64_t magnitude = gain < 0 ? -(int64_t)gain : gain;
+  if (magnitude >= ((int64_t)1 << gain_bits)) {
+    return EFFECT_TAIL_UNBOUNDED;
+  }
+  // level of the input after each pass, with 32 fractional bits
+  uint64_t level = (uint64_t)1 << 32;
+  uint64_t passes = 0;
+  while (level >= ((uint64_t)1 << (32 - bits))) {
+    level = (level * (uint64_t)magnitude) >> gain_bits;
+    passes++;
+  }
+  uint64_t tail = passes * loop_length;
+  return tail < EFFECT_TAIL_UNBOUNDED ? (uint32_t)tail : EFFECT_TAIL_UNBOUNDED;
+}
+
+#endif
@@ -24,6 +24,20 @@
 
 #ifndef FIXEDPOINT_LIB
 #define FIXEDPOINT_LIB 1
+
+#include <stdint.h>
+
+#include "telemetry.h"
+
+// SSE2/AVX2 block kernels are selected at runtime, define FIXEDPOINT_NO_SIMD
+// to always use the scalar code. The telemetry build counts in the scalar
+// code, so it never uses SIMD.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    !defined(FIXEDPOINT_NO_SIMD) && !defined(FPFX_TELEMETRY)
+#define FIXEDPOINT_X86 1
+#include <immintrin.h>
+#endif
+
 /* Defines the number of bits used in the Q16.16 fixed-point format. */
 #define Q16_16_Q_BITS 16
 
@@ -40,6 +54,7 @@
 #define Q16_16_8 524288
 #define Q16_16_MAX 2147418112
 #define Q16_16_2_OVER_PI 41721  // 2 / pi
+#define Q16_16_2_OVER_PI_Q32 2734261102LL  // 2 / pi in Q0.32
 // https://www.nullhardware.com/blog/fixed-point-sine-and-cosine-for-embedded-systems/
 #define Q16_16_SIN_A5 102873  // 4 * (3/pi - 9/16)
 #define Q16_16_SIN_B5 41906   // 2 * a5 - 5 / 2
@@ -49,6 +64,28 @@
  */
 #define Q16_16_FRACTIONAL_BITS (1 << Q16_16_Q_BITS)
 
+/* Compile-time Q formats. A sample always carries its int16 in the top 16
+   bits, Q16.16 in sample units or equally Q1.31 of full scale. The format
+   is that of the gains and coefficients samples get multiplied by: bits is
+   their number of fractional bits, 15 (Q1.15), 16 (Q16.16), 24 (Q8.24) or
+   31 (Q1.31). More bits keep rounding from building up in long feedback
+   loops, fewer leave room for coefficients up to 2^(31 - bits). Products
+   are always formed in 64 bits.
+
+   Effects use FIXEDPOINT_Q_BITS for the coefficients in their feedback
+   loops unless their own *_Q_BITS says otherwise, e.g.
+   -DFIXEDPOINT_Q_BITS=15 -DFV_Q_BITS=31 for a precise freeverb and cheap
+   everything else. */
+#ifndef FIXEDPOINT_Q_BITS
+#define FIXEDPOINT_Q_BITS Q16_16_Q_BITS
+#endif
+#if FIXEDPOINT_Q_BITS < 15 || FIXEDPOINT_Q_BITS > 31
+#error "FIXEDPOINT_Q_BITS must be between 15 and 31"
+#endif
+
+/* 1 with bits fractional bits, 2^31 does not fit an int32. */
+#define Q_ONE(bits) ((int64_t)1 << (bits))
+
 /* Converts a Q16.16 fixed-point value to an int16. */
 int16_t q16_16_fp_to_int16(int32_t fixedValue) {
   /* Shift the fixed-point value right by the number of Q-bits to obtain the
@@ -87,11 +124,88 @@ int32_t q16_16_int32_to_fp(int32_t value) {
   return (int32_t)value << Q16_16_Q_BITS;
 }
 
+/* Converts a float to a value with bits fractional bits, clamping. */
+static inline int32_t q_float_to_fp(float value, unsigned int bits) {
+  float scaled = value * (float)Q_ONE(bits);
+  if (scaled >= 2147483648.0f) {
+    return INT32_MAX;
+  }
+  if (scaled <= -2147483648.0f) {
+    return INT32_MIN;
+  }
+  return (int32_t)scaled;
+}
+
+static inline float q_fp_to_float(int32_t value, unsigned int bits) {
+  return (float)value / (float)Q_ONE(bits);
+}
+
+/* Multiplies a value by one with bits fractional bits, e.g. a sample by a
+   coefficient. */
+static inline int32_t q_multiply(int32_t a, int32_t b, unsigned int bits) {
+  int64_t product = ((int64_t)a * b) >> bits;
+  TELEMETRY_COUNT(overflows, TELEMETRY_WRAPS32(product));
+  return (int32_t)product;
+}
+
 /* Multiplies two Q16.16 fixed-point values. */
 static inline int32_t q16_16_multiply(int32_t a, int32_t b) {
-  /* Multiply the two fixed-point values and shift the result right by the
-     number of Q-bits to obtain the product. */
-  return (int32_t)(((int64_t)a * b) >> Q16_16_Q_BITS);
+  return q_multiply(a, b, Q16_16_Q_BITS);
+}
+
+/* Saturating arithmetic. A result that does not fit clamps to the largest or
+   smallest int32 instead of wrapping around; the clamps compile to
+   conditional moves, there are no branches. */
+
+/* Clamps a wide intermediate to int32. */
+static inline int32_t q16_16_saturate(int64_t x) {
+  TELEMETRY_COUNT(clips, TELEMETRY_WRAPS32(x));
+  x = x > INT32_MAX ? INT32_MAX : x;
+  x = x < INT32_MIN ? INT32_MIN : x;
+  return (int32_t)x;
+}
+
+/* An overflowed sum takes the limit on the side of a, the overflow flag
+   picks it with a cmov. */
+static inline int32_t q16_16_add_sat(int32_t a, int32_t b) {
+  int32_t r;
+  int overflow = __builtin_add_overflow(a, b, &r);
+  TELEMETRY_COUNT(clips, overflow);
+  return overflow ? (a >> 31) ^ INT32_MAX : r;
+}
+
+static inline int32_t q16_16_sub_sat(int32_t a, int32_t b) {
+  int32_t r;
+  int overflow = __builtin_sub_overflow(a, b, &r);
+  TELEMETRY_COUNT(clips, overflow);
+  return overflow ? (a >> 31) ^ INT32_MAX : r;
+}
+
+static inline int32_t q_multiply_sat(int32_t a, int32_t b,
+                                     unsigned int bits) {
+  return q16_16_saturate(((int64_t)a * b) >> bits);
+}
+
+static inline int32_t q16_16_multiply_sat(int32_t a, int32_t b) {
+  return q_multiply_sat(a, b, Q16_16_Q_BITS);
+}
+
+/* a * 2^bits, bits < 32. */
+static inline int32_t q16_16_shift_left_sat(int32_t a, unsigned int bits) {
+  return q16_16_saturate((int64_t)a << bits);
+}
+
+/* Narrows an int32 to int16, clamping. */
+static inline int16_t q16_16_saturate_int16(int32_t x) {
+  TELEMETRY_COUNT(clips, x != (int16_t)x);
+  x = x > INT16_MAX ? INT16_MAX : x;
+  x = x < INT16_MIN ? INT16_MIN : x;
+  return (int16_t)x;
+}
+
+/* The int16 part of a Q16.16 value rounded to nearest, clamping. */
+static inline int16_t q16_16_round_int16(int32_t x) {
+  return (int16_t)(q16_16_add_sat(x, Q16_16_0_5) >> Q16_16_Q_BITS);
 }
 
 int32_t q16_16_divide(int32_t a, int32_t b) {
@@ -100,27 +214,21 @@ int32_t q16_16_divide(int32_t a, int32_t b) {
 }
 
 int32_t q16_16_sin(int32_t fixedValue) {
-  uint8_t negative = 0;
-  while (fixedValue < Q16_16_0) {
-    fixedValue += Q16_16_PI;
-    negative = 1 - negative;
-  }
-  while (fixedValue > Q16_16_PI) {
-    fixedValue -= Q16_16_PI;
-    negative = 1 - negative;
+  /* Quarter turns in Q16.16: the integer part picks the quadrant, the
+     fraction is the position within it, for any argument at the same
+     cost. */
+  int64_t quarters = ((int64_t)fixedValue * Q16_16_2_OVER_PI_Q32) >> 32;
+  unsigned int quadrant = (unsigned int)(quarters >> Q16_16_Q_BITS) & 3;
+  int32_t z = (int32_t)(quarters & (Q16_16_1 - 1));
+  if (quadrant & 1) {
+    z = Q16_16_1 - z;
   }
-  if (fixedValue > Q16_16_PI_OVER_2) {
-    fixedValue = Q16_16_PI_OVER_2 - (fixedValue - Q16_16_PI_OVER_2);
-  }
-  int32_t z = q16_16_multiply(Q16_16_2_OVER_PI, fixedValue);
+  int32_t z2 = q16_16_multiply(z, z);
+  int32_t z3 = q16_16_multiply(z, z2);
   int32_t sin5 = q16_16_multiply(Q16_16_SIN_A5, z);
-  sin5 -=
-      q16_16_multiply(Q16_16_SIN_B5, q16_16_multiply(z, q16_16_multiply(z, z)));
-  sin5 += q16_16_multiply(
-      Q16_16_SIN_C5,
-      q16_16_multiply(
-          z, q16_16_multiply(z, q16_16_multiply(z, q16_16_multiply(z, z)))));
-  if (negative) {
+  sin5 -= q16_16_multiply(Q16_16_SIN_B5, z3);
+  sin5 += q16_16_multiply(Q16_16_SIN_C5, q16_16_multiply(z3, z2));
+  if (quadrant & 2) {
     return -sin5;
   }
   return sin5;
@@ -136,4 +244,602 @@ int32_t q16_16_cos(int32_t fixedValue) {
                          q16_16_sin(fixedValue - Q16_16_PI_OVER_2));
 }
 
-#endif
\ No newline at end of file
+/* Block kernels. The scalar loops are the reference, the SIMD paths give
+   bit-identical results. */
+
+#define Q16_16_SIMD_NONE 0
+#define Q16_16_SIMD_SSE2 1
+#define Q16_16_SIMD_AVX2 2
+
+/* Returns the best instruction set available on this cpu. */
+static inline int q16_16_simd_level(void) {
+#ifdef FIXEDPOINT_X86
+  static int level = -1;
+  if (level < 0) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      level = Q16_16_SIMD_AVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+      level = Q16_16_SIMD_SSE2;
+    } else {
+      level = Q16_16_SIMD_NONE;
+    }
+  }
+  return level;
+#else
+  return Q16_16_SIMD_NONE;
+#endif
+}
+
+#ifdef FIXEDPOINT_X86
+/* q_multiply on four lanes. SSE2 only has an unsigned 32x32->64
+   multiply, the signed product differs from it by (a < 0 ? b : 0) +
+   (b < 0 ? a : 0) in the upper 32 bits, which is subtracted afterwards.
+   The shift counts are loop invariant, the compiler hoists them. */
+__attribute__((target("sse2"))) static inline __m128i q_multiply_sse2(
+    __m128i a, __m128i b, unsigned int bits) {
+  __m128i down = _mm_cvtsi32_si128(bits);
+  __m128i up = _mm_cvtsi32_si128(32 - bits);
+  __m128i even = _mm_srl_epi64(_mm_mul_epu32(a, b), down);
+  __m128i odd = _mm_sll_epi64(
+      _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32)), up);
+  __m128i high = _mm_set_epi32(-1, 0, -1, 0);
+  __m128i r = _mm_or_si128(_mm_and_si128(high, odd),
+                           _mm_andnot_si128(high, even));
+  __m128i corr = _mm_add_epi32(_mm_and_si128(_mm_srai_epi32(a, 31), b),
+                               _mm_and_si128(_mm_srai_epi32(b, 31), a));
+  return _mm_sub_epi32(r, _mm_sll_epi32(corr, up));
+}
+
+/* q_multiply on eight lanes. */
+__attribute__((target("avx2"))) static inline __m256i q_multiply_avx2(
+    __m256i a, __m256i b, unsigned int bits) {
+  __m256i even =
+      _mm256_srl_epi64(_mm256_mul_epi32(a, b), _mm_cvtsi32_si128(bits));
+  __m256i odd = _mm256_sll_epi64(
+      _mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32)),
+      _mm_cvtsi32_si128(32 - bits));
+  return _mm256_blend_epi32(even, odd, 0xAA);
+}
+
+/* q16_16_add_sat on four lanes. An overflowed lane has the sign of neither
+   input and takes the limit on the side of a. */
+__attribute__((target("sse2"))) static inline __m128i q16_16_add_sat_sse2(
+    __m128i a, __m128i b) {
+  __m128i r = _mm_add_epi32(a, b);
+  __m128i overflow = _mm_srai_epi32(
+      _mm_andnot_si128(_mm_xor_si128(a, b), _mm_xor_si128(a, r)), 31);
+  __m128i limit =
+      _mm_xor_si128(_mm_srai_epi32(a, 31), _mm_set1_epi32(INT32_MAX));
+  return _mm_or_si128(_mm_and_si128(overflow, limit),
+                      _mm_andnot_si128(overflow, r));
+}
+
+__attribute__((target("avx2"))) static inline __m256i q16_16_add_sat_avx2(
+    __m256i a, __m256i b) {
+  __m256i r = _mm256_add_epi32(a, b);
+  __m256i overflow = _mm256_srai_epi32(
+      _mm256_andnot_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(a, r)),
+      31);
+  __m256i limit = _mm256_xor_si256(_mm256_srai_epi32(a, 31),
+                                   _mm256_set1_epi32(INT32_MAX));
+  return _mm256_blendv_epi8(r, limit, overflow);
+}
+
+/* q16_16_shift_left_sat on four lanes, a lane overflowed if shifting back
+   does not restore it. */
+__attribute__((target("sse2"))) static inline __m128i
+q16_16_shift_left_sat_sse2(__m128i a, __m128i bits) {
+  __m128i r = _mm_sll_epi32(a, bits);
+  __m128i fits = _mm_cmpeq_epi32(_mm_sra_epi32(r, bits), a);
+  __m128i limit =
+      _mm_xor_si128(_mm_srai_epi32(a, 31), _mm_set1_epi32(INT32_MAX));
+  return _mm_or_si128(_mm_and_si128(fits, r), _mm_andnot_si128(fits, limit));
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+q16_16_shift_left_sat_avx2(__m256i a, __m128i bits) {
+  __m256i r = _mm256_sll_epi32(a, bits);
+  __m256i fits = _mm256_cmpeq_epi32(_mm256_sra_epi32(r, bits), a);
+  __m256i limit = _mm256_xor_si256(_mm256_srai_epi32(a, 31),
+                                   _mm256_set1_epi32(INT32_MAX));
+  return _mm256_blendv_epi8(limit, r, fits);
+}
+
+__attribute__((target("sse2"))) static unsigned int
+q16_16_int16_to_fp_block_sse2(int32_t *dst, const int16_t *src,
+                              unsigned int nr_samples) {
+  unsigned int i = 0;
+  __m128i zero = _mm_setzero_si128();
+  for (; i + 8 <= nr_samples; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi16(zero, x));
+    _mm_storeu_si128((__m128i *)(dst + i + 4), _mm_unpackhi_epi16(zero, x));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static unsigned int
+q16_16_int16_to_fp_block_avx2(int32_t *dst, const int16_t *src,
+                              unsigned int nr_samples) {
+  unsigned int i = 0;
+  for (; i + 8 <= nr_samples; i += 8) {
+    __m256i x = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128((const __m128i *)(src + i)));
+    _mm256_storeu_si256((__m256i *)(dst + i),
+                        _mm256_slli_epi32(x, Q16_16_Q_BITS));
+  }
+  return i;
+}
+
+__attribute__((target("sse2"))) static unsigned int
+q16_16_fp_to_int16_block_sse2(int16_t *dst, const int32_t *src,
+                              unsigned int nr_samples) {
+  unsigned int i = 0;
+  for (; i + 8 <= nr_samples; i += 8) {
+    __m128i a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(src + i)),
+                               Q16_16_Q_BITS);
+    __m128i b = _mm_srai_epi32(
+        _mm_loadu_si128((const __m128i *)(src + i + 4)), Q16_16_Q_BITS);
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static unsigned int
+q16_16_fp_to_int16_block_avx2(int16_t *dst, const int32_t *src,
+                              unsigned int nr_samples) {
+  unsigned int i = 0;
+  for (; i + 16 <= nr_samples; i += 16) {
+    __m256i a = _mm256_srai_epi32(
+        _mm256_loadu_si256((const __m256i *)(src + i)), Q16_16_Q_BITS);
+    __m256i b = _mm256_srai_epi32(
+        _mm256_loadu_si256((const __m256i *)(src + i + 8)), Q16_16_Q_BITS);
+    // packs works within 128-bit lanes, restore the sample order
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+    _mm256_storeu_si256((__m256i *)(dst + i), packed);
+  }
+  return i;
+}
+
+__attribute__((target("sse2"))) static unsigned int
+q16_16_round_int16_block_sse2(int16_t *dst, const int32_t *src,
+                              unsigned int nr_samples) {
+  unsigned int i = 0;
+  __m128i half = _mm_set1_epi32(Q16_16_0_5);
+  for (; i + 8 <= nr_samples; i += 8) {
+    __m128i a = q16_16_add_sat_sse2(
+        _mm_loadu_si128((const __m128i *)(src + i)), half);
+    __m128i b = q16_16_add_sat_sse2(
+        _mm_loadu_si128((const __m128i *)(src + i + 4)), half);
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_packs_epi32(_mm_srai_epi32(a, Q16_16_Q_BITS),
+                                     _mm_srai_epi32(b, Q16_16_Q_BITS)));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static unsigned int
+q16_16_round_int16_block_avx2(int16_t *dst, const int32_t *src,
+                              unsigned int nr_samples) {
+  unsigned int i = 0;
+  __m256i half = _mm256_set1_epi32(Q16_16_0_5);
+  for (; i + 16 <= nr_samples; i += 16) {
+    __m256i a = q16_16_add_sat_avx2(
+        _mm256_loadu_si256((const __m256i *)(src + i)), half);
+    __m256i b = q16_16_add_sat_avx2(
+        _mm256_loadu_si256((const __m256i *)(src + i + 8)), half);
+    __m256i packed = _mm256_packs_epi32(_mm256_srai_epi32(a, Q16_16_Q_BITS),
+                                        _mm256_srai_epi32(b, Q16_16_Q_BITS));
+    _mm256_storeu_si256((__m256i *)(dst + i),
+                        _mm256_permute4x64_epi64(packed, 0xD8));
+  }
+  return i;
+}
+
+__attribute__((target("sse2"))) static unsigned int q_gain_block_sse2(
+    int32_t *buf, int32_t gain, unsigned int bits,
+    unsigned int nr_samples) {
+  unsigned int i = 0;
+  __m128i g = _mm_set1_epi32(gain);
+  for (; i + 4 <= nr_samples; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+    _mm_storeu_si128((__m128i *)(buf + i), q_multiply_sse2(x, g, bits));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static unsigned int q_gain_block_avx2(
+    int32_t *buf, int32_t gain, unsigned int bits,
+    unsigned int nr_samples) {
+  unsigned int i = 0;
+  __m256i g = _mm256_set1_epi32(gain);
+  for (; i + 8 <= nr_samples; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(buf + i));
+    _mm256_storeu_si256((__m256i *)(buf + i), q_multiply_avx2(x, g, bits));
+  }
+  return i;
+}
+
+__attribute__((target("sse2"))) static unsigned int q16_16_mix_block_sse2(
+    int32_t *dst, const int32_t *src, unsigned int nr_samples) {
+  unsigned int i = 0;
+  for (; i + 4 <= nr_samples; i += 4) {
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi32(d, s));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static unsigned int q16_16_mix_block_avx2(
+    int32_t *dst, const int32_t *src, unsigned int nr_samples) {
+  unsigned int i = 0;
+  for (; i + 8 <= nr_samples; i += 8) {
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_add_epi32(d, s));
+  }
+  return i;
+}
+
+__attribute__((target("sse2"))) static unsigned int q_mac_block_sse2(
+    int32_t *dst, const int32_t *src, int32_t gain, unsigned int bits,
+    unsigned int nr_samples) {
+  unsigned int i = 0;
+  __m128i g = _mm_set1_epi32(gain);
+  for (; i + 4 <= nr_samples; i += 4) {
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_add_epi32(d, q_multiply_sse2(s, g, bits)));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static unsigned int q_mac_block_avx2(
+    int32_t *dst, const int32_t *src, int32_t gain, unsigned int bits,
+    unsigned int nr_samples) {
+  unsigned int i = 0;
+  __m256i g = _mm256_set1_epi32(gain);
+  for (; i + 8 <= nr_samples; i += 8) {
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i),
+                        _mm256_add_epi32(d, q_multiply_avx2(s, g, bits)));
+  }
+  return i;
+}
+
+__attribute__((target("sse2"))) static unsigned int q16_16_mix_block_sat_sse2(
+    int32_t *dst, const int32_t *src, unsigned int nr_samples) {
+  unsigned int i = 0;
+  for (; i + 4 <= nr_samples; i += 4) {
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), q16_16_add_sat_sse2(d, s));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static unsigned int q16_16_mix_block_sat_avx2(
+    int32_t *dst, const int32_t *src, unsigned int nr_samples) {
+  unsigned int i = 0;
+  for (; i + 8 <= nr_samples; i += 8) {
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), q16_16_add_sat_avx2(d, s));
+  }
+  return i;
+}
+
+// the gain must keep the products in range, see q_mac_block_sat
+__attribute__((target("sse2"))) static unsigned int q_mac_block_sat_sse2(
+    int32_t *dst, const int32_t *src, int32_t gain, unsigned int bits,
+    unsigned int nr_samples) {
+  unsigned int i = 0;
+  __m128i g = _mm_set1_epi32(gain);
+  for (; i + 4 <= nr_samples; i += 4) {
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     q16_16_add_sat_sse2(d, q_multiply_sse2(s, g, bits)));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static unsigned int q_mac_block_sat_avx2(
+    int32_t *dst, const int32_t *src, int32_t gain, unsigned int bits,
+    unsigned int nr_samples) {
+  unsigned int i = 0;
+  __m256i g = _mm256_set1_epi32(gain);
+  for (; i + 8 <= nr_samples; i += 8) {
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i),
+                        q16_16_add_sat_avx2(d, q_multiply_avx2(s, g, bits)));
+  }
+  return i;
+}
+
+__attribute__((target("sse2"))) static unsigned int
+q16_16_shift_left_block_sat_sse2(int32_t *buf, unsigned int bits,
+                                 unsigned int nr_samples) {
+  unsigned int i = 0;
+  __m128i b = _mm_cvtsi32_si128(bits);
+  for (; i + 4 <= nr_samples; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+    _mm_storeu_si128((__m128i *)(buf + i), q16_16_shift_left_sat_sse2(x, b));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static unsigned int
+q16_16_shift_left_block_sat_avx2(int32_t *buf, unsigned int bits,
+                                 unsigned int nr_samples) {
+  unsigned int i = 0;
+  __m128i b = _mm_cvtsi32_si128(bits);
+  for (; i + 8 <= nr_samples; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(buf + i));
+    _mm256_storeu_si256((__m256i *)(buf + i),
+                        q16_16_shift_left_sat_avx2(x, b));
+  }
+  return i;
+}
+
+__attribute__((target("sse2"))) static unsigned int q16_16_and_block_sse2(
+    int32_t *buf, int32_t mask, unsigned int nr_samples) {
+  unsigned int i = 0;
+  __m128i m = _mm_set1_epi32(mask);
+  for (; i + 4 <= nr_samples; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+    _mm_storeu_si128((__m128i *)(buf + i), _mm_and_si128(x, m));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static unsigned int q16_16_and_block_avx2(
+    int32_t *buf, int32_t mask, unsigned int nr_samples) {
+  unsigned int i = 0;
+  __m256i m = _mm256_set1_epi32(mask);
+  for (; i + 8 <= nr_samples; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(buf + i));
+    _mm256_storeu_si256((__m256i *)(buf + i), _mm256_and_si256(x, m));
+  }
+  return i;
+}
+
+__attribute__((target("sse2"))) static unsigned int
+q16_16_saturate_int16_block_sse2(int16_t *dst, const int32_t *src,
+                                 unsigned int nr_samples) {
+  unsigned int i = 0;
+  for (; i + 8 <= nr_samples; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 4));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+  }
+  return i;
+}
+#endif
+
+/* Converts a block of int16 samples to Q16.16. */
+void q16_16_int16_to_fp_block(int32_t *dst, const int16_t *src,
+                              unsigned int nr_samples) {
+  unsigned int i = 0;
+#ifdef FIXEDPOINT_X86
+  if (q16_16_simd_level() >= Q16_16_SIMD_AVX2) {
+    i = q16_16_int16_to_fp_block_avx2(dst, src, nr_samples);
+  } else if (q16_16_simd_level() >= Q16_16_SIMD_SSE2) {
+    i = q16_16_int16_to_fp_block_sse2(dst, src, nr_samples);
+  }
+#endif
+  for (; i < nr_samples; i++) {
+    dst[i] = q16_16_int16_to_fp(src[i]);
+  }
+}
+
+/* Converts a block of Q16.16 samples to int16. */
+void q16_16_fp_to_int16_block(int16_t *dst, const int32_t *src,
+                              unsigned int nr_samples) {
+  unsigned int i = 0;
+#ifdef FIXEDPOINT_X86
+  if (q16_16_simd_level() >= Q16_16_SIMD_AVX2) {
+    i = q16_16_fp_to_int16_block_avx2(dst, src, nr_samples);
+  } else if (q16_16_simd_level() >= Q16_16_SIMD_SSE2) {
+    i = q16_16_fp_to_int16_block_sse2(dst, src, nr_samples);
+  }
+#endif
+  for (; i < nr_samples; i++) {
+    dst[i] = q16_16_fp_to_int16(src[i]);
+  }
+}
+
+/* Converts a block of Q16.16 samples to int16, rounded to nearest. */
+void q16_16_round_int16_block(int16_t *dst, const int32_t *src,
+                              unsigned int nr_samples) {
+  unsigned int i = 0;
+#ifdef FIXEDPOINT_X86
+  if (q16_16_simd_level() >= Q16_16_SIMD_AVX2) {
+    i = q16_16_round_int16_block_avx2(dst, src, nr_samples);
+  } else if (q16_16_simd_level() >= Q16_16_SIMD_SSE2) {
+    i = q16_16_round_int16_block_sse2(dst, src, nr_samples);
+  }
+#endif
+  for (; i < nr_samples; i++) {
+    dst[i] = q16_16_round_int16(src[i]);
+  }
+}
+
+/* Multiplies a block in place by a gain with bits fractional bits. */
+void q_gain_block(int32_t *buf, int32_t gain, unsigned int bits,
+                  unsigned int nr_samples) {
+  unsigned int i = 0;
+#ifdef FIXEDPOINT_X86
+  if (q16_16_simd_level() >= Q16_16_SIMD_AVX2) {
+    i = q_gain_block_avx2(buf, gain, bits, nr_samples);
+  } else if (q16_16_simd_level() >= Q16_16_SIMD_SSE2) {
+    i = q_gain_block_sse2(buf, gain, bits, nr_samples);
+  }
+#endif
+  for (; i < nr_samples; i++) {
+    buf[i] = q_multiply(buf[i], gain, bits);
+  }
+}
+
+/* Multiplies a block in place by a Q16.16 gain. */
+void q16_16_gain_block(int32_t *buf, int32_t gain, unsigned int nr_samples) {
+  q_gain_block(buf, gain, Q16_16_Q_BITS, nr_samples);
+}
+
+/* Adds src into dst. */
+void q16_16_mix_block(int32_t *dst, const int32_t *src,
+                      unsigned int nr_samples) {
+  unsigned int i = 0;
+#ifdef FIXEDPOINT_X86
+  if (q16_16_simd_level() >= Q16_16_SIMD_AVX2) {
+    i = q16_16_mix_block_avx2(dst, src, nr_samples);
+  } else if (q16_16_simd_level() >= Q16_16_SIMD_SSE2) {
+    i = q16_16_mix_block_sse2(dst, src, nr_samples);
+  }
+#endif
+  for (; i < nr_samples; i++) {
+    TELEMETRY_COUNT(overflows, TELEMETRY_WRAPS32((int64_t)dst[i] + src[i]));
+    dst[i] += src[i];
+  }
+}
+
+/* Adds src scaled by a gain with bits fractional bits into dst. */
+void q_mac_block(int32_t *dst, const int32_t *src, int32_t gain,
+                 unsigned int bits, unsigned int nr_samples) {
+  unsigned int i = 0;
+#ifdef FIXEDPOINT_X86
+  if (q16_16_simd_level() >= Q16_16_SIMD_AVX2) {
+    i = q_mac_block_avx2(dst, src, gain, bits, nr_samples);
+  } else if (q16_16_simd_level() >= Q16_16_SIMD_SSE2) {
+    i = q_mac_block_sse2(dst, src, gain, bits, nr_samples);
+  }
+#endif
+  for (; i < nr_samples; i++) {
+    int32_t product = q_multiply(src[i], gain, bits);
+    TELEMETRY_COUNT(overflows, TELEMETRY_WRAPS32((int64_t)dst[i] + product));
+    dst[i] += product;
+  }
+}
+
+/* Adds src scaled by a Q16.16 gain into dst. */
+void q16_16_mac_block(int32_t *dst, const int32_t *src, int32_t gain,
+                      unsigned int nr_samples) {
+  q_mac_block(dst, src, gain, Q16_16_Q_BITS, nr_samples);
+}
+
+/* Masks every sample in place, e.g. to drop its low bits. */
+void q16_16_and_block(int32_t *buf, int32_t mask, unsigned int nr_samples) {
+  unsigned int i = 0;
+#ifdef FIXEDPOINT_X86
+  if (q16_16_simd_level() >= Q16_16_SIMD_AVX2) {
+    i = q16_16_and_block_avx2(buf, mask, nr_samples);
+  } else if (q16_16_simd_level() >= Q16_16_SIMD_SSE2) {
+    i = q16_16_and_block_sse2(buf, mask, nr_samples);
+  }
+#endif
+  for (; i < nr_samples; i++) {
+    buf[i] &= mask;
+  }
+}
+
+/* Saturating block kernels, for feedback paths where a wrap would turn a
+   loud sample into a full scale one of the opposite sign. SSE2 and AVX2
+   have no saturating 32-bit add, the SIMD paths build it from compares and
+   come out bit-identical to the scalar loops. */
+
+/* Adds src into dst, saturating. */
+void q16_16_mix_block_sat(int32_t *dst, const int32_t *src,
+                          unsigned int nr_samples) {
+  unsigned int i = 0;
+#ifdef FIXEDPOINT_X86
+  if (q16_16_simd_level() >= Q16_16_SIMD_AVX2) {
+    i = q16_16_mix_block_sat_avx2(dst, src, nr_samples);
+  } else if (q16_16_simd_level() >= Q16_16_SIMD_SSE2) {
+    i = q16_16_mix_block_sat_sse2(dst, src, nr_samples);
+  }
+#endif
+  for (; i < nr_samples; i++) {
+    dst[i] = q16_16_add_sat(dst[i], src[i]);
+  }
+}
+
+/* Adds src scaled by a gain with bits fractional bits into dst, saturating
+   both the product and the sum. */
+void q_mac_block_sat(int32_t *dst, const int32_t *src, int32_t gain,
+                     unsigned int bits, unsigned int nr_samples) {
+  unsigned int i = 0;
+#ifdef FIXEDPOINT_X86
+  // with -1 < gain <= 1 a product can't overflow, only the sum is clamped
+  if (gain > -Q_ONE(bits) && gain <= Q_ONE(bits)) {
+    if (q16_16_simd_level() >= Q16_16_SIMD_AVX2) {
+      i = q_mac_block_sat_avx2(dst, src, gain, bits, nr_samples);
+    } else if (q16_16_simd_level() >= Q16_16_SIMD_SSE2) {
+      i = q_mac_block_sat_sse2(dst, src, gain, bits, nr_samples);
+    }
+  }
+#endif
+  for (; i < nr_samples; i++) {
+    dst[i] = q16_16_add_sat(dst[i], q_multiply_sat(src[i], gain, bits));
+  }
+}
+
+void q16_16_mac_block_sat(int32_t *dst, const int32_t *src, int32_t gain,
+                          unsigned int nr_samples) {
+  q_mac_block_sat(dst, src, gain, Q16_16_Q_BITS, nr_samples);
+}
+
+/* Multiplies a block in place by a gain with bits fractional bits,
+   saturating. */
+void q_gain_block_sat(int32_t *buf, int32_t gain, unsigned int bits,
+                      unsigned int nr_samples) {
+  if (gain > -Q_ONE(bits) && gain <= Q_ONE(bits)) {
+    q_gain_block(buf, gain, bits, nr_samples);  // can't overflow
+    return;
+  }
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    buf[i] = q_multiply_sat(buf[i], gain, bits);
+  }
+}
+
+void q16_16_gain_block_sat(int32_t *buf, int32_t gain,
+                           unsigned int nr_samples) {
+  q_gain_block_sat(buf, gain, Q16_16_Q_BITS, nr_samples);
+}
+
+/* Multiplies a block in place by 2^bits, saturating, bits < 32. */
+void q16_16_shift_left_block_sat(int32_t *buf, unsigned int bits,
+                                 unsigned int nr_samples) {
+  unsigned int i = 0;
+#ifdef FIXEDPOINT_X86
+  if (q16_16_simd_level() >= Q16_16_SIMD_AVX2) {
+    i = q16_16_shift_left_block_sat_avx2(buf, bits, nr_samples);
+  } else if (q16_16_simd_level() >= Q16_16_SIMD_SSE2) {
+    i = q16_16_shift_left_block_sat_sse2(buf, bits, nr_samples);
+  }
+#endif
+  for (; i < nr_samples; i++) {
+    buf[i] = q16_16_shift_left_sat(buf[i], bits);
+  }
+}
+
+/* Narrows a block of int32 to int16, clamping, with the packed saturating
+   instructions where there are any. */
+void q16_16_saturate_int16_block(int16_t *dst, const int32_t *src,
+                                 unsigned int nr_samples) {
+  unsigned int i = 0;
+#ifdef FIXEDPOINT_X86
+  if (q16_16_simd_level() >= Q16_16_SIMD_SSE2) {
+    i = q16_16_saturate_int16_block_sse2(dst, src, nr_samples);
+  }
+#endif
+  for (; i < nr_samples; i++) {
+    dst[i] = q16_16_saturate_int16(src[i]);
+  }
+}
+
+#endif
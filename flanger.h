@@ -1,60 +1,152 @@
 #ifndef Flanger_LIB
 #define Flanger_LIB 1
 
-#include <math.h>
-
+#include "arena.h"
+#include "effect.h"
 #include "fixedpoint.h"
+#include "oscillator.h"
+#include "ringbuffer.h"
+
+// longest modulated delay in samples, the delay line holds two more
+#define FLANGER_MAX_DELAY 1022
+// samples per pass, the LFO is rendered one pass ahead of the delay line
+#define FLANGER_CHUNK 256
+// fractional bits of the feedback, see FIXEDPOINT_Q_BITS
+#ifndef FLANGER_Q_BITS
+#define FLANGER_Q_BITS FIXEDPOINT_Q_BITS
+#endif
 
 typedef struct Flanger {
-  int32_t delayLine[4098];  // Fixed-size buffer for the delay line
-  unsigned int maxDelay;    // Maximum delay in samples
-  unsigned int lfoIndex;    // Current index for the LFO
-  unsigned int lfoRate;     // Rate of LFO
-  float depth;              // Depth of modulation
-  float feedback;           // Feedback amount
+  Ringbuffer *delayLine;  // power-of-two delay line, written every sample
+  unsigned int maxDelay;  // Maximum delay in samples
+  Oscillator lfo;         // sine LFO sweeping the delay
+  int32_t depth;          // Q16.16 depth of modulation
+  int32_t sweep;          // Q16.16 samples, depth * maxDelay
+  int32_t feedback;       // feedback amount, FLANGER_Q_BITS fractional bits
 } Flanger;
-Flanger *Flanger_malloc(float feedback) {
-  Flanger *self = (Flanger *)malloc(sizeof(Flanger));
-  if (self == NULL) {
-    // Handle memory allocation failure
-    return NULL;
-  }
 
-  // Initialize the Flanger structure
-  self->maxDelay = 400;       // Adjust as needed, but should not exceed 2048
-  self->lfoRate = 512;        // Example LFO rate, adjust as needed
-  self->depth = 0.5f;         // Example depth, adjust as needed
-  self->feedback = feedback;  // Set feedback
+void Flanger_set_feedback(Flanger *self, float feedback) {
+  self->feedback = q_float_to_fp(feedback, FLANGER_Q_BITS);
+}
 
-  // Initialize delayLine with zeros
-  memset(self->delayLine, 0, sizeof(self->delayLine));
+// depth 0..1 of the maximum delay
+void Flanger_set_depth(Flanger *self, float depth) {
+  self->depth = q16_16_float_to_fp(depth);
+  self->sweep = q16_16_multiply(self->depth, self->maxDelay << Q16_16_Q_BITS);
+}
 
+// LFO period in samples, keeps the current phase
+void Flanger_set_rate(Flanger *self, float period) {
+  Oscillator_set_period(&self->lfo, period);
+}
+
+Flanger *Flanger_alloc(Arena *arena, float feedback) {
+  Flanger *self = (Flanger *)Arena_alloc(arena, sizeof(Flanger));
+  Ringbuffer *delayLine = Ringbuffer_alloc_pow2(arena, FLANGER_MAX_DELAY + 2);
+  if (self == NULL || delayLine == NULL) {
+    return NULL;
+  }
+  self->delayLine = delayLine;
+  self->maxDelay = 400;  // Adjust as needed, up to FLANGER_MAX_DELAY
+  Oscillator_init(&self->lfo, OSCILLATOR_SINE);
+  Flanger_set_rate(self, 512);
+  Flanger_set_depth(self, 0.5f);
+  Flanger_set_feedback(self, feedback);
   return self;
 }
 
+// a single heap block, the Flanger comes first in it
+Flanger *Flanger_malloc(float feedback) {
+  Arena arena;
+  Arena_sizing(&arena);
+  Flanger_alloc(&arena, feedback);
+  if (Arena_malloc(&arena, arena.used) != 0) {
+    return NULL;
+  }
+  return Flanger_alloc(&arena, feedback);
+}
+
 void Flanger_process(Flanger *self, int32_t *buf, unsigned int nr_samples) {
-  for (unsigned int i = 0; i < nr_samples; i++) {
-    // Calculate current delay using LFO
-    float lfoValue =
-        (sin(2 * M_PI * self->lfoIndex / (float)self->lfoRate) + 1) / 2;
-    unsigned int currentDelay = lfoValue * self->depth * self->maxDelay;
-    self->lfoIndex = (self->lfoIndex + 1) % self->lfoRate;
-
-    // Calculate read index for the delay line
-    int readIndex = i - currentDelay;
-    if (readIndex < 0) {
-      readIndex += self->maxDelay;  // Wrap around if negative
+  int32_t currentDelay[FLANGER_CHUNK];
+  // the delay sweeps from 1 to 1 + sweep samples, at least one sample behind
+  // the write head so the sample about to be written is never read
+  int32_t center = Q16_16_1 + self->sweep / 2;
+  for (unsigned int i = 0; i < nr_samples; i += FLANGER_CHUNK) {
+    unsigned int n = nr_samples - i;
+    if (n > FLANGER_CHUNK) {
+      n = FLANGER_CHUNK;
     }
+    Oscillator_process(&self->lfo, currentDelay, n, center, self->sweep / 2);
+    for (unsigned int k = 0; k < n; k++) {
+      int32_t delayedSample =
+          Ringbuffer_tap_frac(self->delayLine, currentDelay[k]);
+
+      // Apply feedback
+      int32_t fed =
+          q_multiply_sat(self->feedback, delayedSample, FLANGER_Q_BITS);
+      Ringbuffer_add(self->delayLine, q16_16_add_sat(buf[i + k], fed));
 
-    // Read from delay line
-    int32_t delayedSample = self->delayLine[readIndex % self->maxDelay];
+      // Mix delayed signal with the original signal
+      buf[i + k] = (int32_t)(((int64_t)buf[i + k] + delayedSample) >> 1);
+    }
+  }
+}
 
-    // Apply feedback
-    self->delayLine[i % self->maxDelay] =
-        buf[i] + (int32_t)(self->feedback * delayedSample);
+void Flanger_reset(Flanger *self) {
+  Ringbuffer_clear(self->delayLine);
+  self->lfo.phase = 0;
+}
 
-    // Mix delayed signal with the original signal
-    buf[i] = (buf[i] + delayedSample) / 2;
+int Flanger_set_param(Flanger *self, const char *param, float value) {
+  if (strcmp(param, "feedback") == 0) {
+    Flanger_set_feedback(self, value);
+    return 0;
+  }
+  if (strcmp(param, "depth") == 0 && value >= 0 && value <= 1) {
+    Flanger_set_depth(self, value);
+    return 0;
   }
+  if (strcmp(param, "rate") == 0 && value >= 1) {
+    Flanger_set_rate(self, value);
+    return 0;
+  }
+  return -1;
+}
+
+// the delay never reaches past the line, the feedback scales each pass
+uint32_t Flanger_tail(Flanger *self) {
+  return Effect_feedback_tail(self->delayLine->nr_samples, self->feedback,
+                              FLANGER_Q_BITS, EFFECT_TAIL_BITS);
+}
+
+// only the LFO moves with time
+void Flanger_advance(Flanger *self, uint32_t n) {
+  self->lfo.phase += self->lfo.increment * n;
 }
+
+void Flanger_free(Flanger *self) { free(self); }
+
+static void Flanger_effect_process(void *self, int32_t *buf,
+                                   unsigned int nr_samples) {
+  Flanger_process((Flanger *)self, buf, nr_samples);
+}
+
+static int Flanger_effect_set_param(void *self, const char *param,
+                                    float value) {
+  return Flanger_set_param((Flanger *)self, param, value);
+}
+
+static void Flanger_effect_reset(void *self) { Flanger_reset((Flanger *)self); }
+
+static uint32_t Flanger_effect_tail(void *self) {
+  return Flanger_tail((Flanger *)self);
+}
+
+static void Flanger_effect_advance(void *self, uint32_t n) {
+  Flanger_advance((Flanger *)self, n);
+}
+
+const EffectOps Flanger_ops = {"flanger", Flanger_effect_process,
+                               Flanger_effect_set_param, Flanger_effect_reset,
+                               Flanger_effect_tail, Flanger_effect_advance};
 #endif
\ No newline at end of file
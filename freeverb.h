@@ -1,37 +1,49 @@
+#ifndef FV_REVERB_FLOAT_LIB
+#define FV_REVERB_FLOAT_LIB 1
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The original floating point freeverb, kept as the reference freeverb_fp.h
+// is measured against (see reference.h). Everything is prefixed FVF_ so the
+// two can be built into one program. Samples are floats, full scale is 1.
 
-#define undenormalise(sample) \
-  if (((*(unsigned int *)&(sample)) & 0x7f800000) == 0) (sample) = 0.0f
+// flushes denormals to zero, compared rather than type punned so that
+// optimizing compilers keep it
+#define FVF_undenormalise(sample) \
+  if (fabsf(sample) < FLT_MIN) (sample) = 0.0f
 
-typedef struct FV_AllPass {
+typedef struct FVF_AllPass {
   float feedback;
   float *buffer;
   int bufsize;
   int bufidx;
-} FV_AllPass;
+} FVF_AllPass;
 
 // Function implementations
-void FV_AllPass_init(FV_AllPass *self) {
+void FVF_AllPass_init(FVF_AllPass *self) {
   self->buffer = NULL;
   self->feedback = 0.5;
   self->bufsize = 0;
   self->bufidx = 0;
 }
 
-void FV_AllPass_setbuffer(FV_AllPass *self, float *buf, int size) {
-  if (self->buffer) {
-    free(self->buffer);
-  }
+// the buffer is borrowed, whoever owns it frees it
+void FVF_AllPass_setbuffer(FVF_AllPass *self, float *buf, int size) {
   self->buffer = buf;
   self->bufsize = size;
 }
 
-float FV_AllPass_process(FV_AllPass *self, float input) {
+float FVF_AllPass_process(FVF_AllPass *self, float input) {
   float output;
   float bufout;
 
   bufout = self->buffer[self->bufidx];
-  undenormalise(bufout);
+  FVF_undenormalise(bufout);
 
   output = -input + bufout;
   self->buffer[self->bufidx] = input + (bufout * self->feedback);
@@ -41,19 +53,19 @@ float FV_AllPass_process(FV_AllPass *self, float input) {
   return output;
 }
 
-void FV_AllPass_mute(FV_AllPass *self) {
+void FVF_AllPass_mute(FVF_AllPass *self) {
   for (int i = 0; i < self->bufsize; i++) self->buffer[i] = 0;
 }
 
-void FV_AllPass_setfeedback(FV_AllPass *self, float val) {
+void FVF_AllPass_setfeedback(FVF_AllPass *self, float val) {
   self->feedback = val;
 }
 
-float FV_AllPass_getfeedback(FV_AllPass *self) { return self->feedback; }
+float FVF_AllPass_getfeedback(FVF_AllPass *self) { return self->feedback; }
 
 // comb filter
 
-typedef struct FV_Comb {
+typedef struct FVF_Comb {
   float feedback;
   float filterstore;
   float damp1;
@@ -61,9 +73,9 @@ typedef struct FV_Comb {
   float *buffer;
   int bufsize;
   int bufidx;
-} FV_Comb;
+} FVF_Comb;
 
-void FV_Comb_init(FV_Comb *self) {
+void FVF_Comb_init(FVF_Comb *self) {
   self->feedback = 0.5f;
   self->filterstore = 0.0f;
   self->damp1 = 0.0f;
@@ -73,89 +85,154 @@ void FV_Comb_init(FV_Comb *self) {
   self->bufidx = 0;
 }
 
-void FV_Comb_free(FV_Comb *self) {
-  if (self->buffer) {
-    free(self->buffer);
-  }
-  free(self);
-}
+void FVF_Comb_free(FVF_Comb *self) { free(self); }
 
-static inline float FV_Comb_process(FV_Comb *self, float input) {
+static inline float FVF_Comb_process(FVF_Comb *self, float input) {
   float output = self->buffer[self->bufidx];
-  undenormalise(output);
+  FVF_undenormalise(output);
   self->filterstore =
       (output * self->damp2) + (self->filterstore * self->damp1);
-  undenormalise(self->filterstore);
+  FVF_undenormalise(self->filterstore);
   self->buffer[self->bufidx] = input + (self->filterstore * self->feedback);
   if (++self->bufidx >= self->bufsize) self->bufidx = 0;
   return output;
 }
 
-void FV_Comb_mute(FV_Comb *self) {
+void FVF_Comb_mute(FVF_Comb *self) {
   for (int i = 0; i < self->bufsize; i++) self->buffer[i] = 0;
 }
 
-void FV_Comb_setbuffer(FV_Comb *self, float *buf, int size) {
-  if (self->buffer) {
-    free(self->buffer);
-  }
+// the buffer is borrowed, whoever owns it frees it
+void FVF_Comb_setbuffer(FVF_Comb *self, float *buf, int size) {
   self->buffer = buf;
   self->bufsize = size;
 }
 
-void FV_Comb_setfeedback(FV_Comb *self, float val) { self->feedback = val; }
+void FVF_Comb_setfeedback(FVF_Comb *self, float val) { self->feedback = val; }
 
-void FV_Comb_setdamp(FV_Comb *self, float val) {
+void FVF_Comb_setdamp(FVF_Comb *self, float val) {
   self->damp1 = val;
   self->damp2 = 1 - val;
 }
 
-float FV_Comb_getfeedback(FV_Comb *self) { return self->feedback; }
+float FVF_Comb_getfeedback(FVF_Comb *self) { return self->feedback; }
 
 // tuning
-#define FV_NUMCOMBS 8
-#define FV_NUMALLPASSES 4
-#define FV_MUTED 0.0f
-#define FV_FIXEDGAIN 0.015f
-#define FV_SCALEWET 3.0f
-#define FV_SCALEDRY 2.0f
-#define FV_SCALEDAMP 0.4f
-#define FV_SCALEROOM 0.28f
-#define FV_OFFSETROOM 0.7f
-#define FV_INITIALROOM 0.8f
-#define FV_INITIALDAMP 0.15f
-#define FV_INITIALWET 0.7f
-#define FV_INITIALDRY 0.3f
-#define FV_INITIALWIDTH 1.0f
-#define FV_INITIALMODE 0.0f
-#define FV_FREEZEMODE 0.5f
-#define FV_STEREOSPREAD 23
-#define FV_COMBTUNINGL1 1116
-#define FV_COMBTUNINGR1 (1116 + FV_STEREOSPREAD)
-#define FV_COMBTUNINGL2 1188
-#define FV_COMBTUNINGR2 (1188 + FV_STEREOSPREAD)
-#define FV_COMBTUNINGL3 1277
-#define FV_COMBTUNINGR3 (1277 + FV_STEREOSPREAD)
-#define FV_COMBTUNINGL4 1356
-#define FV_COMBTUNINGR4 (1356 + FV_STEREOSPREAD)
-#define FV_COMBTUNINGL5 1422
-#define FV_COMBTUNINGR5 (1422 + FV_STEREOSPREAD)
-#define FV_COMBTUNINGL6 1491
-#define FV_COMBTUNINGR6 (1491 + FV_STEREOSPREAD)
-#define FV_COMBTUNINGL7 1557
-#define FV_COMBTUNINGR7 (1557 + FV_STEREOSPREAD)
-#define FV_COMBTUNINGL8 1617
-#define FV_COMBTUNINGR8 (1617 + FV_STEREOSPREAD)
-#define FV_ALLPASSTUNINGL1 556
-#define FV_ALLPASSTUNINGR1 (556 + FV_STEREOSPREAD)
-#define FV_ALLPASSTUNINGL2 441
-#define FV_ALLPASSTUNINGR2 (441 + FV_STEREOSPREAD)
-#define FV_ALLPASSTUNINGL3 341
-#define FV_ALLPASSTUNINGR3 (341 + FV_STEREOSPREAD)
-#define FV_ALLPASSTUNINGL4 225
-#define FV_ALLPASSTUNINGR4 (225 + FV_STEREOSPREAD)
-
-typedef struct FV_Reverb {
+#define FVF_NUMCOMBS 8
+#define FVF_NUMALLPASSES 4
+#define FVF_MUTED 0.0f
+#define FVF_FIXEDGAIN 0.015f
+#define FVF_SCALEWET 3.0f
+#define FVF_SCALEDRY 2.0f
+#define FVF_SCALEDAMP 0.4f
+#define FVF_SCALEROOM 0.28f
+#define FVF_OFFSETROOM 0.7f
+#define FVF_INITIALROOM 0.8f
+#define FVF_INITIALDAMP 0.15f
+#define FVF_INITIALWET 0.7f
+#define FVF_INITIALDRY 0.3f
+#define FVF_INITIALWIDTH 1.0f
+#define FVF_INITIALMODE 0.0f
+#define FVF_FREEZEMODE 0.5f
+#define FVF_STEREOSPREAD 23
+#define FVF_COMBTUNINGL1 1116
+#define FVF_COMBTUNINGR1 (1116 + FVF_STEREOSPREAD)
+#define FVF_COMBTUNINGL2 1188
+#define FVF_COMBTUNINGR2 (1188 + FVF_STEREOSPREAD)
+#define FVF_COMBTUNINGL3 1277
+#define FVF_COMBTUNINGR3 (1277 + FVF_STEREOSPREAD)
+#define FVF_COMBTUNINGL4 1356
+#define FVF_COMBTUNINGR4 (1356 + FVF_STEREOSPREAD)
+#define FVF_COMBTUNINGL5 1422
+#define FVF_COMBTUNINGR5 (1422 + FVF_STEREOSPREAD)
+#define FVF_COMBTUNINGL6 1491
+#define FVF_COMBTUNINGR6 (1491 + FVF_STEREOSPREAD)
+#define FVF_COMBTUNINGL7 1557
+#define FVF_COMBTUNINGR7 (1557 + FVF_STEREOSPREAD)
+#define FVF_COMBTUNINGL8 1617
+#define FVF_COMBTUNINGR8 (1617 + FVF_STEREOSPREAD)
+#define FVF_ALLPASSTUNINGL1 556
+#define FVF_ALLPASSTUNINGR1 (556 + FVF_STEREOSPREAD)
+#define FVF_ALLPASSTUNINGL2 441
+#define FVF_ALLPASSTUNINGR2 (441 + FVF_STEREOSPREAD)
+#define FVF_ALLPASSTUNINGL3 341
+#define FVF_ALLPASSTUNINGR3 (341 + FVF_STEREOSPREAD)
+#define FVF_ALLPASSTUNINGL4 225
+#define FVF_ALLPASSTUNINGR4 (225 + FVF_STEREOSPREAD)
+
+const int FVF_combtuning[FVF_NUMCOMBS] = {
+    FVF_COMBTUNINGL1, FVF_COMBTUNINGL2, FVF_COMBTUNINGL3, FVF_COMBTUNINGL4,
+    FVF_COMBTUNINGL5, FVF_COMBTUNINGL6, FVF_COMBTUNINGL7, FVF_COMBTUNINGL8};
+
+const int FVF_allpasstuning[FVF_NUMALLPASSES] = {
+    FVF_ALLPASSTUNINGL1, FVF_ALLPASSTUNINGL2, FVF_ALLPASSTUNINGL3,
+    FVF_ALLPASSTUNINGL4};
+
+#define FVF_COMB_LENGTH                                                   \
+  (FVF_COMBTUNINGL1 + FVF_COMBTUNINGL2 + FVF_COMBTUNINGL3 + FVF_COMBTUNINGL4 + \
+   FVF_COMBTUNINGL5 + FVF_COMBTUNINGL6 + FVF_COMBTUNINGL7 + FVF_COMBTUNINGL8)
+#define FVF_ALLPASS_LENGTH                                         \
+  (FVF_ALLPASSTUNINGL1 + FVF_ALLPASSTUNINGL2 + FVF_ALLPASSTUNINGL3 + \
+   FVF_ALLPASSTUNINGL4)
+
+// one channel of the reverb network: the combs feeding the allpasses
+typedef struct FVF_Channel {
+  FVF_Comb comb[FVF_NUMCOMBS];
+  FVF_AllPass allpass[FVF_NUMALLPASSES];
+  float bufcomb[FVF_COMB_LENGTH + FVF_NUMCOMBS * FVF_STEREOSPREAD];
+  float bufallpass[FVF_ALLPASS_LENGTH + FVF_NUMALLPASSES * FVF_STEREOSPREAD];
+} FVF_Channel;
+
+void FVF_Channel_init(FVF_Channel *self, int spread) {
+  int offset = 0;
+  for (int i = 0; i < FVF_NUMCOMBS; i++) {
+    FVF_Comb_init(&self->comb[i]);
+    FVF_Comb_setbuffer(&self->comb[i], self->bufcomb + offset,
+                      FVF_combtuning[i] + spread);
+    offset += FVF_combtuning[i] + spread;
+  }
+  offset = 0;
+  for (int i = 0; i < FVF_NUMALLPASSES; i++) {
+    FVF_AllPass_init(&self->allpass[i]);
+    FVF_AllPass_setbuffer(&self->allpass[i], self->bufallpass + offset,
+                         FVF_allpasstuning[i] + spread);
+    offset += FVF_allpasstuning[i] + spread;
+  }
+}
+
+void FVF_Channel_mute(FVF_Channel *self) {
+  for (int i = 0; i < FVF_NUMCOMBS; i++) {
+    FVF_Comb_mute(&self->comb[i]);
+  }
+  for (int i = 0; i < FVF_NUMALLPASSES; i++) {
+    FVF_AllPass_mute(&self->allpass[i]);
+  }
+}
+
+void FVF_Channel_update(FVF_Channel *self, float feedback, float damp) {
+  for (int i = 0; i < FVF_NUMCOMBS; i++) {
+    FVF_Comb_setfeedback(&self->comb[i], feedback);
+    FVF_Comb_setdamp(&self->comb[i], damp);
+  }
+}
+
+static inline float FVF_Channel_process(FVF_Channel *self, float input_gained) {
+  float out = 0;
+  // accumluate comb filters in parallel
+  for (int j = 0; j < FVF_NUMCOMBS; j++) {
+    out += FVF_Comb_process(&self->comb[j], input_gained);
+  }
+  // feed through allpasses in series
+  for (int j = 0; j < FVF_NUMALLPASSES; j++) {
+    out = FVF_AllPass_process(&self->allpass[j], out);
+  }
+  return out;
+}
+
+#define FVF_MONO 0
+#define FVF_STEREO 1
+
+typedef struct FVF_Reverb {
   float gain;
   float roomsize, roomsize1;
   float damp, damp1;
@@ -164,173 +241,170 @@ typedef struct FV_Reverb {
   float width;
   float mode;
 
-  // Comb filters
-  FV_Comb combL[FV_NUMCOMBS];
-  FV_Comb combR[FV_NUMCOMBS];
-
-  // Allpass filters
-  FV_AllPass allpassL[FV_NUMALLPASSES];
-  FV_AllPass allpassR[FV_NUMALLPASSES];
-
-  // Buffers for the combs
-  float bufcombL1[FV_COMBTUNINGL1], bufcombR1[FV_COMBTUNINGR1];
-  float bufcombL2[FV_COMBTUNINGL2], bufcombR2[FV_COMBTUNINGR2];
-  float bufcombL3[FV_COMBTUNINGL3], bufcombR3[FV_COMBTUNINGR3];
-  float bufcombL4[FV_COMBTUNINGL4], bufcombR4[FV_COMBTUNINGR4];
-  float bufcombL5[FV_COMBTUNINGL5], bufcombR5[FV_COMBTUNINGR5];
-  float bufcombL6[FV_COMBTUNINGL6], bufcombR6[FV_COMBTUNINGR6];
-  float bufcombL7[FV_COMBTUNINGL7], bufcombR7[FV_COMBTUNINGR7];
-  float bufcombL8[FV_COMBTUNINGL8], bufcombR8[FV_COMBTUNINGR8];
-
-  // Buffers for the allpasses
-  float bufallpassL1[FV_ALLPASSTUNINGL1], bufallpassR1[FV_ALLPASSTUNINGR1];
-  float bufallpassL2[FV_ALLPASSTUNINGL2], bufallpassR2[FV_ALLPASSTUNINGR2];
-  float bufallpassL3[FV_ALLPASSTUNINGL3], bufallpassR3[FV_ALLPASSTUNINGR3];
-  float bufallpassL4[FV_ALLPASSTUNINGL4], bufallpassR4[FV_ALLPASSTUNINGR4];
-} FV_Reverb;
-
-float FV_Reverb_getmode(FV_Reverb *self) {
-  if (self->mode >= FV_FREEZEMODE)
+  // the right channel only exists in stereo, mono skips it entirely
+  FVF_Channel *right;
+  FVF_Channel left;
+} FVF_Reverb;
+
+float FVF_Reverb_getmode(FVF_Reverb *self) {
+  if (self->mode >= FVF_FREEZEMODE)
     return 1.0f;
   else
     return 0.0f;
 }
 
-void FV_Reverb_mute(FV_Reverb *self) {
-  if (FV_Reverb_getmode(self) >= FV_FREEZEMODE) {
+void FVF_Reverb_mute(FVF_Reverb *self) {
+  if (FVF_Reverb_getmode(self) >= FVF_FREEZEMODE) {
     return;
   }
-  for (int i = 0; i < FV_NUMCOMBS; i++) {
-    FV_Comb_mute(&self->combL[i]);
-    FV_Comb_mute(&self->combR[i]);
-  }
-  for (int i = 0; i < FV_NUMALLPASSES; i++) {
-    FV_AllPass_mute(&self->allpassL[i]);
-    FV_AllPass_mute(&self->allpassR[i]);
+  FVF_Channel_mute(&self->left);
+  if (self->right != NULL) {
+    FVF_Channel_mute(self->right);
   }
 }
 
-void FV_Reverb_update(FV_Reverb *self) {
-  int i;
-
+void FVF_Reverb_update(FVF_Reverb *self) {
   self->wet1 = self->wet * (self->width / 2 + 0.5);
   self->wet2 = self->wet * ((1 - self->width) / 2);
 
-  //   if (self->mode >= FV_FREEZEMODE) {
+  //   if (self->mode >= FVF_FREEZEMODE) {
   //     self->roomsize1 = 1;
   //     self->damp1 = 0;
-  //     self->gain = FV_MUTED;
+  //     self->gain = FVF_MUTED;
   //   } else {
   self->roomsize1 = self->roomsize;
   self->damp1 = self->damp;
-  self->gain = FV_FIXEDGAIN;
+  self->gain = FVF_FIXEDGAIN;
   //}
 
-  for (i = 0; i < FV_NUMCOMBS; i++) {
-    FV_Comb_setfeedback(&self->combL[i], self->roomsize1);
-    FV_Comb_setfeedback(&self->combR[i], self->roomsize1);
-    FV_Comb_setdamp(&self->combL[i], self->damp1);
-    FV_Comb_setdamp(&self->combR[i], self->damp1);
+  FVF_Channel_update(&self->left, self->roomsize1, self->damp1);
+  if (self->right != NULL) {
+    FVF_Channel_update(self->right, self->roomsize1, self->damp1);
   }
 }
 
-void FV_Reverb_setroomsize(FV_Reverb *self, float value) {
-  self->roomsize = value * FV_SCALEROOM + FV_OFFSETROOM;
+void FVF_Reverb_setroomsize(FVF_Reverb *self, float value) {
+  self->roomsize = value * FVF_SCALEROOM + FVF_OFFSETROOM;
 }
 
-void FV_Reverb_setdamp(FV_Reverb *self, float value) {
-  self->damp = value * FV_SCALEDAMP;
+void FVF_Reverb_setdamp(FVF_Reverb *self, float value) {
+  self->damp = value * FVF_SCALEDAMP;
 }
 
-void FV_Reverb_setwet(FV_Reverb *self, float value) {
-  self->wet = value * FV_SCALEWET;
+void FVF_Reverb_setwet(FVF_Reverb *self, float value) {
+  self->wet = value * FVF_SCALEWET;
 }
 
-void FV_Reverb_setdry(FV_Reverb *self, float value) {
-  self->dry = value * FV_SCALEDRY;
+void FVF_Reverb_setdry(FVF_Reverb *self, float value) {
+  self->dry = value * FVF_SCALEDRY;
 }
 
-void FV_Reverb_setwidth(FV_Reverb *self, float value) { self->width = value; }
+void FVF_Reverb_setwidth(FVF_Reverb *self, float value) { self->width = value; }
 
-void FV_Reverb_setmode(FV_Reverb *self, float value) { self->mode = value; }
+void FVF_Reverb_setmode(FVF_Reverb *self, float value) { self->mode = value; }
 
-void FV_Reverb_init(FV_Reverb *self) {
-  for (int i = 0; i < FV_NUMCOMBS; i++) {
-    FV_Comb_init(&self->combL[i]);
-    FV_Comb_init(&self->combR[i]);
+/**
+ * Initialize a FVF_Reverb instance.
+ * @param self Pointer to the FVF_Reverb instance.
+ * @param right Storage for the right channel, NULL for a mono reverb.
+ */
+void FVF_Reverb_init(FVF_Reverb *self, FVF_Channel *right) {
+  FVF_Channel_init(&self->left, 0);
+  self->right = right;
+  if (right != NULL) {
+    FVF_Channel_init(right, FVF_STEREOSPREAD);
   }
 
-  FV_Comb_setbuffer(&self->combL[0], self->bufcombL1, FV_COMBTUNINGL1);
-  FV_Comb_setbuffer(&self->combR[0], self->bufcombR1, FV_COMBTUNINGR1);
-  FV_Comb_setbuffer(&self->combL[1], self->bufcombL2, FV_COMBTUNINGL2);
-  FV_Comb_setbuffer(&self->combR[1], self->bufcombR2, FV_COMBTUNINGR2);
-  FV_Comb_setbuffer(&self->combL[2], self->bufcombL3, FV_COMBTUNINGL3);
-  FV_Comb_setbuffer(&self->combR[2], self->bufcombR3, FV_COMBTUNINGR3);
-  FV_Comb_setbuffer(&self->combL[3], self->bufcombL4, FV_COMBTUNINGL4);
-  FV_Comb_setbuffer(&self->combR[3], self->bufcombR4, FV_COMBTUNINGR4);
-  FV_Comb_setbuffer(&self->combL[4], self->bufcombL5, FV_COMBTUNINGL5);
-  FV_Comb_setbuffer(&self->combR[4], self->bufcombR5, FV_COMBTUNINGR5);
-  FV_Comb_setbuffer(&self->combL[5], self->bufcombL6, FV_COMBTUNINGL6);
-  FV_Comb_setbuffer(&self->combR[5], self->bufcombR6, FV_COMBTUNINGR6);
-  FV_Comb_setbuffer(&self->combL[6], self->bufcombL7, FV_COMBTUNINGL7);
-  FV_Comb_setbuffer(&self->combR[6], self->bufcombR7, FV_COMBTUNINGR7);
-  FV_Comb_setbuffer(&self->combL[7], self->bufcombL8, FV_COMBTUNINGL8);
-  FV_Comb_setbuffer(&self->combR[7], self->bufcombR8, FV_COMBTUNINGR8);
-
-  for (int i = 0; i < FV_NUMALLPASSES; i++) {
-    FV_AllPass_init(&self->allpassL[i]);
-    FV_AllPass_init(&self->allpassR[i]);
-  }
+  FVF_Reverb_setroomsize(self, FVF_INITIALROOM);
+  FVF_Reverb_setdamp(self, FVF_INITIALDAMP);
+  FVF_Reverb_setwet(self, FVF_INITIALWET);
+  FVF_Reverb_setdry(self, FVF_INITIALDRY);
+  FVF_Reverb_setwidth(self, FVF_INITIALWIDTH);
+  FVF_Reverb_setmode(self, FVF_INITIALMODE);
+  FVF_Reverb_update(self);
 
-  FV_AllPass_setbuffer(&self->allpassL[0], self->bufallpassL1,
-                       FV_ALLPASSTUNINGL1);
-  FV_AllPass_setbuffer(&self->allpassR[0], self->bufallpassR1,
-                       FV_ALLPASSTUNINGR1);
-  FV_AllPass_setbuffer(&self->allpassL[1], self->bufallpassL2,
-                       FV_ALLPASSTUNINGL2);
-  FV_AllPass_setbuffer(&self->allpassR[1], self->bufallpassR2,
-                       FV_ALLPASSTUNINGR2);
-  FV_AllPass_setbuffer(&self->allpassL[2], self->bufallpassL3,
-                       FV_ALLPASSTUNINGL3);
-  FV_AllPass_setbuffer(&self->allpassR[2], self->bufallpassR3,
-                       FV_ALLPASSTUNINGR3);
-  FV_AllPass_setbuffer(&self->allpassL[3], self->bufallpassL4,
-                       FV_ALLPASSTUNINGL4);
-  FV_AllPass_setbuffer(&self->allpassR[3], self->bufallpassR4,
-                       FV_ALLPASSTUNINGR4);
-
-  FV_Reverb_setroomsize(self, FV_INITIALROOM);
-  FV_Reverb_setdamp(self, FV_INITIALDAMP);
-  FV_Reverb_setwet(self, FV_INITIALWET);
-  FV_Reverb_setdry(self, FV_INITIALDRY);
-  FV_Reverb_setwidth(self, FV_INITIALWIDTH);
-  FV_Reverb_setmode(self, FV_INITIALMODE);
-  FV_Reverb_update(self);
-
-  FV_Reverb_mute(self);
+  FVF_Reverb_mute(self);
 }
 
-void FV_Reverb_process(FV_Reverb *self, int32_t *buf, unsigned int nr_samples) {
-  float outL, outR, input, input_gained;
-  for (int i = 0; i < nr_samples; i++) {
-    outL = outR = 0;
-    // convert int32_t to float
-    input = (float)buf[i] / 32768.0f;
-    input_gained = input * self->gain;
-
-    // accumluate comb filters in parallel
-    for (int j = 0; j < FV_NUMCOMBS; j++) {
-      outL += FV_Comb_process(&self->combL[j], input_gained);
-      outR += FV_Comb_process(&self->combR[j], input_gained);
-    }
+// mono in, mono out, only the left network runs
+void FVF_Reverb_process(FVF_Reverb *self, float *buf, unsigned int nr_samples) {
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    float outL = FVF_Channel_process(&self->left, buf[i] * self->gain);
+    buf[i] = buf[i] * self->dry + outL * self->wet;
+  }
+}
 
-    // feed through allpasses in series
-    for (int j = 0; j < FV_NUMALLPASSES; j++) {
-      outL = FV_AllPass_process(&self->allpassL[j], outL);
-      outR = FV_AllPass_process(&self->allpassR[j], outR);
+/**
+ * Process split stereo buffers in place, applying width. A mono reverb
+ * feeds the same wet signal to both sides.
+ */
+void FVF_Reverb_process_stereo(FVF_Reverb *self, float *left, float *right,
+                               unsigned int nr_samples) {
+  float outL, outR, input_gained;
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    input_gained = (left[i] + right[i]) * self->gain;
+
+    outL = FVF_Channel_process(&self->left, input_gained);
+    if (self->right != NULL) {
+      outR = FVF_Channel_process(self->right, input_gained);
+    } else {
+      outR = outL;
     }
 
-    // calculate output mixing with anything already there
-    buf[i] = (int32_t)(32768 * (((input)*self->dry) + (outL * self->wet)));
+    float l = outL * self->wet1 + outR * self->wet2 + left[i] * self->dry;
+    float r = outR * self->wet1 + outL * self->wet2 + right[i] * self->dry;
+    left[i] = l;
+    right[i] = r;
   }
 }
+
+// interleaved L/R frames, processed in place
+void FVF_Reverb_process_interleaved(FVF_Reverb *self, float *buf,
+                                    unsigned int nr_frames) {
+  for (unsigned int i = 0; i < nr_frames; i++) {
+    FVF_Reverb_process_stereo(self, &buf[2 * i], &buf[2 * i + 1], 1);
+  }
+}
+
+// parameters as FV_Reverb_set_param takes them, in the 0..1 range
+int FVF_Reverb_set_param(FVF_Reverb *self, const char *param, float value) {
+  if (strcmp(param, "roomsize") == 0) {
+    FVF_Reverb_setroomsize(self, value);
+  } else if (strcmp(param, "damp") == 0) {
+    FVF_Reverb_setdamp(self, value);
+  } else if (strcmp(param, "wet") == 0) {
+    FVF_Reverb_setwet(self, value);
+  } else if (strcmp(param, "dry") == 0) {
+    FVF_Reverb_setdry(self, value);
+  } else if (strcmp(param, "width") == 0) {
+    FVF_Reverb_setwidth(self, value);
+  } else {
+    return -1;
+  }
+  FVF_Reverb_update(self);
+  return 0;
+}
+
+// channels is FVF_MONO or FVF_STEREO, mono instances don't allocate the right
+// channel at all
+FVF_Reverb *FVF_Reverb_malloc(int channels) {
+  size_t size = sizeof(FVF_Reverb);
+  if (channels == FVF_STEREO) {
+    size += sizeof(FVF_Channel);
+  }
+  FVF_Reverb *self = (FVF_Reverb *)malloc(size);
+  if (self == NULL) {
+    return NULL;
+  }
+  FVF_Reverb_init(self,
+                  channels == FVF_STEREO ? (FVF_Channel *)(self + 1) : NULL);
+  return self;
+}
+
+void FVF_Reverb_free(FVF_Reverb *self) {
+  if (self != NULL) {
+    free(self);
+  }
+}
+
+#endif
@@ -1,10 +1,30 @@
+#ifndef FV_REVERB_FP_LIB
+#define FV_REVERB_FP_LIB 1
+
 #include <stdio.h>
+#include <stdlib.h>
 
+#include "arena.h"
+#include "effect.h"
 #include "fixedpoint.h"
+#include "ringbuffer.h"
+
+// fractional bits of the comb and allpass coefficients, the reverb's long
+// feedback loops, see FIXEDPOINT_Q_BITS. The wet and dry gains stay Q16.16.
+#ifndef FV_Q_BITS
+#define FV_Q_BITS FIXEDPOINT_Q_BITS
+#endif
+#define FV_Q_HALF ((int32_t)(Q_ONE(FV_Q_BITS) / 2))
+
+// 1 - val, 1 itself rounds down to the largest value in Q1.31
+static inline int32_t FV_one_minus(int32_t val) {
+  int64_t r = Q_ONE(FV_Q_BITS) - val;
+  return r > INT32_MAX ? INT32_MAX : (int32_t)r;
+}
 
 typedef struct FV_AllPass {
   int32_t feedback;
-  int32_t *buffer;
+  DelaySample *buffer;
   int bufsize;
   int bufidx;
 } FV_AllPass;
@@ -12,15 +32,13 @@ typedef struct FV_AllPass {
 // Function implementations
 void FV_AllPass_init(FV_AllPass *self) {
   self->buffer = NULL;
-  self->feedback = Q16_16_0_5;
+  self->feedback = FV_Q_HALF;
   self->bufsize = 0;
   self->bufidx = 0;
 }
 
-void FV_AllPass_setbuffer(FV_AllPass *self, int32_t *buf, int size) {
-  if (self->buffer) {
-    free(self->buffer);
-  }
+// the buffer is borrowed, whoever owns it frees it
+void FV_AllPass_setbuffer(FV_AllPass *self, DelaySample *buf, int size) {
   self->buffer = buf;
   self->bufsize = size;
 }
@@ -29,10 +47,11 @@ int32_t FV_AllPass_process(FV_AllPass *self, int32_t input) {
   int32_t output;
   int32_t bufout;
 
-  bufout = self->buffer[self->bufidx];
+  bufout = DelaySample_load(self->buffer[self->bufidx]);
 
   output = -input + bufout;
-  self->buffer[self->bufidx] = input + q16_16_multiply(bufout, self->feedback);
+  self->buffer[self->bufidx] = DelaySample_store(
+      q16_16_add_sat(input, q_multiply(bufout, self->feedback, FV_Q_BITS)));
 
   if (++(self->bufidx) >= self->bufsize) self->bufidx = 0;
 
@@ -54,13 +73,13 @@ typedef struct FV_Comb {
   int32_t filterstore;
   int32_t damp1;
   int32_t damp2;
-  int32_t *buffer;
+  DelaySample *buffer;
   int bufsize;
   int bufidx;
 } FV_Comb;
 
 void FV_Comb_init(FV_Comb *self) {
-  self->feedback = Q16_16_0_5;
+  self->feedback = FV_Q_HALF;
   self->filterstore = 0;
   self->damp1 = 0;
   self->damp2 = 0;
@@ -69,19 +88,14 @@ void FV_Comb_init(FV_Comb *self) {
   self->bufidx = 0;
 }
 
-void FV_Comb_free(FV_Comb *self) {
-  if (self->buffer) {
-    free(self->buffer);
-  }
-  free(self);
-}
+void FV_Comb_free(FV_Comb *self) { free(self); }
 
 static inline int32_t FV_Comb_process(FV_Comb *self, int32_t input) {
-  int32_t output = self->buffer[self->bufidx];
-  self->filterstore = q16_16_multiply(output, self->damp2) +
-                      q16_16_multiply(self->filterstore, self->damp1);
-  self->buffer[self->bufidx] =
-      input + q16_16_multiply(self->filterstore, self->feedback);
+  int32_t output = DelaySample_load(self->buffer[self->bufidx]);
+  self->filterstore = q_multiply(output, self->damp2, FV_Q_BITS) +
+                      q_multiply(self->filterstore, self->damp1, FV_Q_BITS);
+  self->buffer[self->bufidx] = DelaySample_store(q16_16_add_sat(
+      input, q_multiply(self->filterstore, self->feedback, FV_Q_BITS)));
   if (++self->bufidx >= self->bufsize) self->bufidx = 0;
   return output;
 }
@@ -90,10 +104,8 @@ void FV_Comb_mute(FV_Comb *self) {
   for (int i = 0; i < self->bufsize; i++) self->buffer[i] = 0;
 }
 
-void FV_Comb_setbuffer(FV_Comb *self, int32_t *buf, int size) {
-  if (self->buffer) {
-    free(self->buffer);
-  }
+// the buffer is borrowed, whoever owns it frees it
+void FV_Comb_setbuffer(FV_Comb *self, DelaySample *buf, int size) {
   self->buffer = buf;
   self->bufsize = size;
 }
@@ -102,7 +114,7 @@ void FV_Comb_setfeedback(FV_Comb *self, int32_t val) { self->feedback = val; }
 
 void FV_Comb_setdamp(FV_Comb *self, int32_t val) {
   self->damp1 = val;
-  self->damp2 = Q16_16_1 - val;
+  self->damp2 = FV_one_minus(val);
 }
 
 // tuning
@@ -112,9 +124,9 @@ void FV_Comb_setdamp(FV_Comb *self, int32_t val) {
 #define FV_FIXEDGAIN (q16_16_float_to_fp(0.015f))
 #define FV_SCALEWET (3 * Q16_16_1)
 #define FV_SCALEDRY (2 * Q16_16_1)
-#define FV_SCALEDAMP (q16_16_float_to_fp(0.4f))
-#define FV_SCALEROOM (q16_16_float_to_fp(0.28f))
-#define FV_OFFSETROOM (q16_16_float_to_fp(0.7f))
+#define FV_SCALEDAMP (q_float_to_fp(0.4f, FV_Q_BITS))
+#define FV_SCALEROOM (q_float_to_fp(0.28f, FV_Q_BITS))
+#define FV_OFFSETROOM (q_float_to_fp(0.7f, FV_Q_BITS))
 #define FV_INITIALROOM (q16_16_float_to_fp(0.8f))
 #define FV_INITIALDAMP (q16_16_float_to_fp(0.15f))
 #define FV_INITIALWET (q16_16_float_to_fp(0.7f))
@@ -148,56 +160,238 @@ void FV_Comb_setdamp(FV_Comb *self, int32_t val) {
 #define FV_ALLPASSTUNINGL4 225
 #define FV_ALLPASSTUNINGR4 (225 + FV_STEREOSPREAD)
 
+// comb bank: the eight parallel combs of one channel kept as arrays so that
+// a single vector step updates all of them per sample
+#define FV_COMBBANK_LENGTH                                               \
+  (FV_COMBTUNINGL1 + FV_COMBTUNINGL2 + FV_COMBTUNINGL3 + FV_COMBTUNINGL4 + \
+   FV_COMBTUNINGL5 + FV_COMBTUNINGL6 + FV_COMBTUNINGL7 + FV_COMBTUNINGL8)
+// samples per pass through FV_CombBank_process
+#define FV_COMBBANK_CHUNK 256
+
+typedef struct FV_CombBank {
+  int32_t feedback[FV_NUMCOMBS];
+  int32_t filterstore[FV_NUMCOMBS];
+  int32_t damp1[FV_NUMCOMBS];
+  int32_t damp2[FV_NUMCOMBS];
+  int32_t offset[FV_NUMCOMBS];
+  int32_t bufidx[FV_NUMCOMBS];
+  int32_t bufsize[FV_NUMCOMBS];
+  DelaySample *buffer;  // all delay lines back to back
+} FV_CombBank;
+
+const int FV_combtuning[FV_NUMCOMBS] = {
+    FV_COMBTUNINGL1, FV_COMBTUNINGL2, FV_COMBTUNINGL3, FV_COMBTUNINGL4,
+    FV_COMBTUNINGL5, FV_COMBTUNINGL6, FV_COMBTUNINGL7, FV_COMBTUNINGL8};
+
+// spread is added to every tuning, buf must hold
+// FV_COMBBANK_LENGTH + FV_NUMCOMBS * spread samples
+void FV_CombBank_init(FV_CombBank *self, DelaySample *buf, int spread) {
+  int offset = 0;
+  self->buffer = buf;
+  for (int j = 0; j < FV_NUMCOMBS; j++) {
+    self->feedback[j] = FV_Q_HALF;
+    self->filterstore[j] = 0;
+    self->damp1[j] = 0;
+    self->damp2[j] = 0;
+    self->offset[j] = offset;
+    self->bufidx[j] = 0;
+    self->bufsize[j] = FV_combtuning[j] + spread;
+    offset += self->bufsize[j];
+  }
+}
+
+void FV_CombBank_mute(FV_CombBank *self) {
+  int length = self->offset[FV_NUMCOMBS - 1] + self->bufsize[FV_NUMCOMBS - 1];
+  memset(self->buffer, 0, length * sizeof(DelaySample));
+}
+
+void FV_CombBank_reset(FV_CombBank *self) {
+  FV_CombBank_mute(self);
+  for (int j = 0; j < FV_NUMCOMBS; j++) {
+    self->filterstore[j] = 0;
+    self->bufidx[j] = 0;
+  }
+}
+
+void FV_CombBank_setfeedback(FV_CombBank *self, int32_t val) {
+  for (int j = 0; j < FV_NUMCOMBS; j++) self->feedback[j] = val;
+}
+
+void FV_CombBank_setdamp(FV_CombBank *self, int32_t val) {
+  for (int j = 0; j < FV_NUMCOMBS; j++) {
+    self->damp1[j] = val;
+    self->damp2[j] = FV_one_minus(val);
+  }
+}
+
+#ifdef FIXEDPOINT_X86
+__attribute__((target("avx2"))) static void FV_CombBank_process_avx2(
+    FV_CombBank *self, const int32_t *input, int32_t *output,
+    unsigned int nr_samples) {
+  __m256i feedback = _mm256_loadu_si256((const __m256i *)self->feedback);
+  __m256i damp1 = _mm256_loadu_si256((const __m256i *)self->damp1);
+  __m256i damp2 = _mm256_loadu_si256((const __m256i *)self->damp2);
+  __m256i offset = _mm256_loadu_si256((const __m256i *)self->offset);
+  __m256i bufsize = _mm256_loadu_si256((const __m256i *)self->bufsize);
+  __m256i filterstore =
+      _mm256_loadu_si256((const __m256i *)self->filterstore);
+  __m256i bufidx = _mm256_loadu_si256((const __m256i *)self->bufidx);
+  __m256i one = _mm256_set1_epi32(1);
+  int32_t pos[FV_NUMCOMBS] __attribute__((aligned(32)));
+  int32_t in[FV_NUMCOMBS] __attribute__((aligned(32)));
+
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    __m256i p = _mm256_add_epi32(offset, bufidx);
+    __m256i out = _mm256_i32gather_epi32((const int *)self->buffer, p,
+                                         sizeof(DelaySample));
+#ifdef FPFX_COMPACT_DELAY
+    // 32 bits were gathered at each 16-bit sample, the sample is the low
+    // half. The last comb's last sample reads into the padding after it,
+    // see FV_Channel.
+    out = _mm256_slli_epi32(out, Q16_16_Q_BITS);
+#endif
+    filterstore =
+        _mm256_add_epi32(q_multiply_avx2(out, damp2, FV_Q_BITS),
+                         q_multiply_avx2(filterstore, damp1, FV_Q_BITS));
+    __m256i x = q16_16_add_sat_avx2(
+        _mm256_set1_epi32(input[i]),
+        q_multiply_avx2(filterstore, feedback, FV_Q_BITS));
+
+    // there is no scatter in avx2
+    _mm256_store_si256((__m256i *)pos, p);
+    _mm256_store_si256((__m256i *)in, x);
+    for (int j = 0; j < FV_NUMCOMBS; j++) {
+      self->buffer[pos[j]] = DelaySample_store(in[j]);
+    }
+
+    // wrap each index back to 0 when it reaches the comb length
+    bufidx = _mm256_add_epi32(bufidx, one);
+    bufidx = _mm256_and_si256(bufidx, _mm256_cmpgt_epi32(bufsize, bufidx));
+
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(out),
+                                _mm256_extracti128_si256(out, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    output[i] = _mm_cvtsi128_si32(sum);
+  }
+
+  _mm256_storeu_si256((__m256i *)self->filterstore, filterstore);
+  _mm256_storeu_si256((__m256i *)self->bufidx, bufidx);
+}
+#endif
+
+// runs the bank over a block, output[i] is the sum of the comb outputs
+void FV_CombBank_process(FV_CombBank *self, const int32_t *input,
+                         int32_t *output, unsigned int nr_samples) {
+#ifdef FIXEDPOINT_X86
+  if (q16_16_simd_level() >= Q16_16_SIMD_AVX2) {
+    FV_CombBank_process_avx2(self, input, output, nr_samples);
+    return;
+  }
+#endif
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    int32_t sum = 0;
+    for (int j = 0; j < FV_NUMCOMBS; j++) {
+      DelaySample *p = self->buffer + self->offset[j] + self->bufidx[j];
+      int32_t out = DelaySample_load(*p);
+      self->filterstore[j] =
+          q_multiply(out, self->damp2[j], FV_Q_BITS) +
+          q_multiply(self->filterstore[j], self->damp1[j], FV_Q_BITS);
+      *p = DelaySample_store(q16_16_add_sat(
+          input[i],
+          q_multiply(self->filterstore[j], self->feedback[j], FV_Q_BITS)));
+      if (++self->bufidx[j] >= self->bufsize[j]) self->bufidx[j] = 0;
+      sum += out;
+    }
+    output[i] = sum;
+  }
+}
+
+#define FV_ALLPASS_LENGTH                                         \
+  (FV_ALLPASSTUNINGL1 + FV_ALLPASSTUNINGL2 + FV_ALLPASSTUNINGL3 + \
+   FV_ALLPASSTUNINGL4)
+
+const int FV_allpasstuning[FV_NUMALLPASSES] = {
+    FV_ALLPASSTUNINGL1, FV_ALLPASSTUNINGL2, FV_ALLPASSTUNINGL3,
+    FV_ALLPASSTUNINGL4};
+
+// one channel of the reverb network: the comb bank feeding the allpasses
+typedef struct FV_Channel {
+  FV_CombBank comb;
+  FV_AllPass allpass[FV_NUMALLPASSES];
+  // one more sample for the compact avx2 gather, which reads 32 bits at the
+  // last comb's last 16-bit sample
+  DelaySample bufcomb[FV_COMBBANK_LENGTH + FV_NUMCOMBS * FV_STEREOSPREAD + 1];
+  DelaySample bufallpass[FV_ALLPASS_LENGTH +
+                         FV_NUMALLPASSES * FV_STEREOSPREAD];
+} FV_Channel;
+
+void FV_Channel_init(FV_Channel *self, int spread) {
+  FV_CombBank_init(&self->comb, self->bufcomb, spread);
+  int offset = 0;
+  for (int i = 0; i < FV_NUMALLPASSES; i++) {
+    FV_AllPass_init(&self->allpass[i]);
+    FV_AllPass_setbuffer(&self->allpass[i], self->bufallpass + offset,
+                         FV_allpasstuning[i] + spread);
+    offset += FV_allpasstuning[i] + spread;
+  }
+}
+
+void FV_Channel_mute(FV_Channel *self) {
+  FV_CombBank_mute(&self->comb);
+  for (int i = 0; i < FV_NUMALLPASSES; i++) {
+    FV_AllPass_mute(&self->allpass[i]);
+  }
+}
+
+void FV_Channel_reset(FV_Channel *self) {
+  FV_CombBank_reset(&self->comb);
+  for (int i = 0; i < FV_NUMALLPASSES; i++) {
+    FV_AllPass_mute(&self->allpass[i]);
+    self->allpass[i].bufidx = 0;
+  }
+}
+
+// runs the combs in parallel and the allpasses in series over a block
+void FV_Channel_process(FV_Channel *self, const int32_t *input_gained,
+                        int32_t *output, unsigned int nr_samples) {
+  FV_CombBank_process(&self->comb, input_gained, output, nr_samples);
+  for (unsigned int k = 0; k < nr_samples; k++) {
+    int32_t out = output[k];
+    for (int j = 0; j < FV_NUMALLPASSES; j++) {
+      out = FV_AllPass_process(&self->allpass[j], out);
+    }
+    output[k] = out;
+  }
+}
+
+#define FV_MONO 0
+#define FV_STEREO 1
+
 typedef struct FV_Reverb {
   int32_t gain;
-  int32_t roomsize, roomsize1;
+  int32_t roomsize, roomsize1;  // FV_Q_BITS, like damp
   int32_t damp, damp1;
   int32_t wet, wet1, wet2;
   int32_t dry;
   int32_t width;
   int32_t mode;
 
-  // Comb filters
-  FV_Comb combL[FV_NUMCOMBS];
-  FV_Comb combR[FV_NUMCOMBS];
-
-  // Allpass filters
-  FV_AllPass allpassL[FV_NUMALLPASSES];
-  FV_AllPass allpassR[FV_NUMALLPASSES];
-
-  // Buffers for the combs
-  int32_t bufcombL1[FV_COMBTUNINGL1], bufcombR1[FV_COMBTUNINGR1];
-  int32_t bufcombL2[FV_COMBTUNINGL2], bufcombR2[FV_COMBTUNINGR2];
-  int32_t bufcombL3[FV_COMBTUNINGL3], bufcombR3[FV_COMBTUNINGR3];
-  int32_t bufcombL4[FV_COMBTUNINGL4], bufcombR4[FV_COMBTUNINGR4];
-  int32_t bufcombL5[FV_COMBTUNINGL5], bufcombR5[FV_COMBTUNINGR5];
-  int32_t bufcombL6[FV_COMBTUNINGL6], bufcombR6[FV_COMBTUNINGR6];
-  int32_t bufcombL7[FV_COMBTUNINGL7], bufcombR7[FV_COMBTUNINGR7];
-  int32_t bufcombL8[FV_COMBTUNINGL8], bufcombR8[FV_COMBTUNINGR8];
-
-  // Buffers for the allpasses
-  int32_t bufallpassL1[FV_ALLPASSTUNINGL1], bufallpassR1[FV_ALLPASSTUNINGR1];
-  int32_t bufallpassL2[FV_ALLPASSTUNINGL2], bufallpassR2[FV_ALLPASSTUNINGR2];
-  int32_t bufallpassL3[FV_ALLPASSTUNINGL3], bufallpassR3[FV_ALLPASSTUNINGR3];
-  int32_t bufallpassL4[FV_ALLPASSTUNINGL4], bufallpassR4[FV_ALLPASSTUNINGR4];
+  // the right channel only exists in stereo, mono skips it entirely
+  FV_Channel *right;
+  FV_Channel left;
 } FV_Reverb;
 
 void FV_Reverb_mute(FV_Reverb *self) {
-  for (int i = 0; i < FV_NUMCOMBS; i++) {
-    FV_Comb_mute(&self->combL[i]);
-    FV_Comb_mute(&self->combR[i]);
-  }
-  for (int i = 0; i < FV_NUMALLPASSES; i++) {
-    FV_AllPass_mute(&self->allpassL[i]);
-    FV_AllPass_mute(&self->allpassR[i]);
+  FV_Channel_mute(&self->left);
+  if (self->right != NULL) {
+    FV_Channel_mute(self->right);
   }
 }
 
 void FV_Reverb_update(FV_Reverb *self) {
-  int i;
-
-  self->wet1 = self->wet * (self->width / 2 + 0.5);
-  self->wet2 = self->wet * ((1 - self->width) / 2);
+  self->wet1 = q16_16_multiply(self->wet, self->width / 2 + Q16_16_0_5);
+  self->wet2 = q16_16_multiply(self->wet, (Q16_16_1 - self->width) / 2);
 
   //   if (self->mode >= FV_FREEZEMODE) {
   //     self->roomsize1 = 1;
@@ -209,20 +403,21 @@ void FV_Reverb_update(FV_Reverb *self) {
   self->gain = FV_FIXEDGAIN;
   //}
 
-  for (i = 0; i < FV_NUMCOMBS; i++) {
-    FV_Comb_setfeedback(&self->combL[i], self->roomsize1);
-    FV_Comb_setfeedback(&self->combR[i], self->roomsize1);
-    FV_Comb_setdamp(&self->combL[i], self->damp1);
-    FV_Comb_setdamp(&self->combR[i], self->damp1);
+  FV_CombBank_setfeedback(&self->left.comb, self->roomsize1);
+  FV_CombBank_setdamp(&self->left.comb, self->damp1);
+  if (self->right != NULL) {
+    FV_CombBank_setfeedback(&self->right->comb, self->roomsize1);
+    FV_CombBank_setdamp(&self->right->comb, self->damp1);
   }
 }
 
 void FV_Reverb_setroomsize(FV_Reverb *self, int32_t value) {
-  self->roomsize = q16_16_multiply(value, FV_SCALEROOM) + FV_OFFSETROOM;
+  self->roomsize =
+      q_multiply(value, FV_SCALEROOM, Q16_16_Q_BITS) + FV_OFFSETROOM;
 }
 
 void FV_Reverb_setdamp(FV_Reverb *self, int32_t value) {
-  self->damp = q16_16_multiply(value, FV_SCALEDAMP);
+  self->damp = q_multiply(value, FV_SCALEDAMP, Q16_16_Q_BITS);
 }
 
 void FV_Reverb_setwet(FV_Reverb *self, int32_t value) {
@@ -237,51 +432,18 @@ void FV_Reverb_setwidth(FV_Reverb *self, int32_t value) { self->width = value; }
 
 void FV_Reverb_setmode(FV_Reverb *self, int32_t value) { self->mode = value; }
 
-void FV_Reverb_init(FV_Reverb *self) {
-  for (int i = 0; i < FV_NUMCOMBS; i++) {
-    FV_Comb_init(&self->combL[i]);
-    FV_Comb_init(&self->combR[i]);
-  }
-
-  FV_Comb_setbuffer(&self->combL[0], self->bufcombL1, FV_COMBTUNINGL1);
-  FV_Comb_setbuffer(&self->combR[0], self->bufcombR1, FV_COMBTUNINGR1);
-  FV_Comb_setbuffer(&self->combL[1], self->bufcombL2, FV_COMBTUNINGL2);
-  FV_Comb_setbuffer(&self->combR[1], self->bufcombR2, FV_COMBTUNINGR2);
-  FV_Comb_setbuffer(&self->combL[2], self->bufcombL3, FV_COMBTUNINGL3);
-  FV_Comb_setbuffer(&self->combR[2], self->bufcombR3, FV_COMBTUNINGR3);
-  FV_Comb_setbuffer(&self->combL[3], self->bufcombL4, FV_COMBTUNINGL4);
-  FV_Comb_setbuffer(&self->combR[3], self->bufcombR4, FV_COMBTUNINGR4);
-  FV_Comb_setbuffer(&self->combL[4], self->bufcombL5, FV_COMBTUNINGL5);
-  FV_Comb_setbuffer(&self->combR[4], self->bufcombR5, FV_COMBTUNINGR5);
-  FV_Comb_setbuffer(&self->combL[5], self->bufcombL6, FV_COMBTUNINGL6);
-  FV_Comb_setbuffer(&self->combR[5], self->bufcombR6, FV_COMBTUNINGR6);
-  FV_Comb_setbuffer(&self->combL[6], self->bufcombL7, FV_COMBTUNINGL7);
-  FV_Comb_setbuffer(&self->combR[6], self->bufcombR7, FV_COMBTUNINGR7);
-  FV_Comb_setbuffer(&self->combL[7], self->bufcombL8, FV_COMBTUNINGL8);
-  FV_Comb_setbuffer(&self->combR[7], self->bufcombR8, FV_COMBTUNINGR8);
-
-  for (int i = 0; i < FV_NUMALLPASSES; i++) {
-    FV_AllPass_init(&self->allpassL[i]);
-    FV_AllPass_init(&self->allpassR[i]);
+/**
+ * Initialize a FV_Reverb instance.
+ * @param self Pointer to the FV_Reverb instance.
+ * @param right Storage for the right channel, NULL for a mono reverb.
+ */
+void FV_Reverb_init(FV_Reverb *self, FV_Channel *right) {
+  FV_Channel_init(&self->left, 0);
+  self->right = right;
+  if (right != NULL) {
+    FV_Channel_init(right, FV_STEREOSPREAD);
   }
 
-  FV_AllPass_setbuffer(&self->allpassL[0], self->bufallpassL1,
-                       FV_ALLPASSTUNINGL1);
-  FV_AllPass_setbuffer(&self->allpassR[0], self->bufallpassR1,
-                       FV_ALLPASSTUNINGR1);
-  FV_AllPass_setbuffer(&self->allpassL[1], self->bufallpassL2,
-                       FV_ALLPASSTUNINGL2);
-  FV_AllPass_setbuffer(&self->allpassR[1], self->bufallpassR2,
-                       FV_ALLPASSTUNINGR2);
-  FV_AllPass_setbuffer(&self->allpassL[2], self->bufallpassL3,
-                       FV_ALLPASSTUNINGL3);
-  FV_AllPass_setbuffer(&self->allpassR[2], self->bufallpassR3,
-                       FV_ALLPASSTUNINGR3);
-  FV_AllPass_setbuffer(&self->allpassL[3], self->bufallpassL4,
-                       FV_ALLPASSTUNINGL4);
-  FV_AllPass_setbuffer(&self->allpassR[3], self->bufallpassR4,
-                       FV_ALLPASSTUNINGR4);
-
   FV_Reverb_setroomsize(self, FV_INITIALROOM);
   FV_Reverb_setdamp(self, FV_INITIALDAMP);
   FV_Reverb_setwet(self, FV_INITIALWET);
@@ -293,28 +455,194 @@ void FV_Reverb_init(FV_Reverb *self) {
   FV_Reverb_mute(self);
 }
 
+// mono in, mono out, only the left network runs
 void FV_Reverb_process(FV_Reverb *self, int32_t *buf, unsigned int nr_samples) {
-  int32_t outL, outR, input, input_gained;
-  for (int i = 0; i < nr_samples; i++) {
-    outL = outR = 0;
-    // convert int32_t to float
-    input = buf[i];
-    input_gained = q16_16_multiply(input, self->gain);
-
-    // accumluate comb filters in parallel
-    for (int j = 0; j < FV_NUMCOMBS; j++) {
-      outL += FV_Comb_process(&self->combL[j], input_gained);
-      outR += FV_Comb_process(&self->combR[j], input_gained);
+  int32_t input_gained[FV_COMBBANK_CHUNK];
+  int32_t outL[FV_COMBBANK_CHUNK];
+  for (unsigned int i = 0; i < nr_samples; i += FV_COMBBANK_CHUNK) {
+    unsigned int n = nr_samples - i;
+    if (n > FV_COMBBANK_CHUNK) {
+      n = FV_COMBBANK_CHUNK;
     }
-
-    // feed through allpasses in series
-    for (int j = 0; j < FV_NUMALLPASSES; j++) {
-      outL = FV_AllPass_process(&self->allpassL[j], outL);
-      outR = FV_AllPass_process(&self->allpassR[j], outR);
+    for (unsigned int k = 0; k < n; k++) {
+      input_gained[k] = q16_16_multiply(buf[i + k], self->gain);
     }
 
+    FV_Channel_process(&self->left, input_gained, outL, n);
+
     // calculate output mixing with anything already there
-    buf[i] =
-        q16_16_multiply(input, self->dry) + q16_16_multiply(outL, self->wet);
+    for (unsigned int k = 0; k < n; k++) {
+      buf[i + k] = q16_16_multiply(buf[i + k], self->dry) +
+                   q16_16_multiply(outL[k], self->wet);
+    }
+  }
+}
+
+/**
+ * Process split stereo buffers in place, applying width. A mono reverb
+ * feeds the same wet signal to both sides.
+ */
+void FV_Reverb_process_stereo(FV_Reverb *self, int32_t *left, int32_t *right,
+                              unsigned int nr_samples) {
+  int32_t input_gained[FV_COMBBANK_CHUNK];
+  int32_t outL[FV_COMBBANK_CHUNK], outR[FV_COMBBANK_CHUNK];
+  for (unsigned int i = 0; i < nr_samples; i += FV_COMBBANK_CHUNK) {
+    unsigned int n = nr_samples - i;
+    if (n > FV_COMBBANK_CHUNK) {
+      n = FV_COMBBANK_CHUNK;
+    }
+    // the sum of two loud sides needs 33 bits, the gain brings it back
+    for (unsigned int k = 0; k < n; k++) {
+      int64_t sum = (int64_t)left[i + k] + right[i + k];
+      input_gained[k] = (int32_t)((sum * self->gain) >> Q16_16_Q_BITS);
+    }
+
+    FV_Channel_process(&self->left, input_gained, outL, n);
+    if (self->right != NULL) {
+      FV_Channel_process(self->right, input_gained, outR, n);
+    } else {
+      memcpy(outR, outL, n * sizeof(int32_t));
+    }
+
+    for (unsigned int k = 0; k < n; k++) {
+      int32_t l = q16_16_multiply(outL[k], self->wet1) +
+                  q16_16_multiply(outR[k], self->wet2) +
+                  q16_16_multiply(left[i + k], self->dry);
+      int32_t r = q16_16_multiply(outR[k], self->wet1) +
+                  q16_16_multiply(outL[k], self->wet2) +
+                  q16_16_multiply(right[i + k], self->dry);
+      left[i + k] = l;
+      right[i + k] = r;
+    }
+  }
+}
+
+// interleaved L/R frames, processed in place
+void FV_Reverb_process_interleaved(FV_Reverb *self, int32_t *buf,
+                                   unsigned int nr_frames) {
+  int32_t left[FV_COMBBANK_CHUNK], right[FV_COMBBANK_CHUNK];
+  for (unsigned int i = 0; i < nr_frames; i += FV_COMBBANK_CHUNK) {
+    unsigned int n = nr_frames - i;
+    if (n > FV_COMBBANK_CHUNK) {
+      n = FV_COMBBANK_CHUNK;
+    }
+    int32_t *frames = buf + 2 * i;
+    for (unsigned int k = 0; k < n; k++) {
+      left[k] = frames[2 * k];
+      right[k] = frames[2 * k + 1];
+    }
+    FV_Reverb_process_stereo(self, left, right, n);
+    for (unsigned int k = 0; k < n; k++) {
+      frames[2 * k] = left[k];
+      frames[2 * k + 1] = right[k];
+    }
+  }
+}
+
+// channels is FV_MONO or FV_STEREO, mono instances don't allocate the right
+// channel at all
+FV_Reverb *FV_Reverb_malloc(int channels) {
+  size_t size = sizeof(FV_Reverb);
+  if (channels == FV_STEREO) {
+    size += sizeof(FV_Channel);
+  }
+  FV_Reverb *self = (FV_Reverb *)malloc(size);
+  if (self == NULL) {
+    return NULL;
+  }
+  FV_Reverb_init(self, channels == FV_STEREO ? (FV_Channel *)(self + 1) : NULL);
+  return self;
+}
+
+void FV_Reverb_reset(FV_Reverb *self) {
+  FV_Channel_reset(&self->left);
+  if (self->right != NULL) {
+    FV_Channel_reset(self->right);
+  }
+}
+
+FV_Reverb *FV_Reverb_alloc(Arena *arena, int channels) {
+  FV_Reverb *self = (FV_Reverb *)Arena_alloc(arena, sizeof(FV_Reverb));
+  FV_Channel *right = NULL;
+  if (channels == FV_STEREO) {
+    right = (FV_Channel *)Arena_alloc(arena, sizeof(FV_Channel));
+  }
+  if (self == NULL || (channels == FV_STEREO && right == NULL)) {
+    return NULL;
+  }
+  FV_Reverb_init(self, right);
+  return self;
+}
+
+// parameters are given in the 0..1 range of the original freeverb
+int FV_Reverb_set_param(FV_Reverb *self, const char *param, float value) {
+  int32_t v = q16_16_float_to_fp(value);
+  if (strcmp(param, "roomsize") == 0) {
+    FV_Reverb_setroomsize(self, v);
+  } else if (strcmp(param, "damp") == 0) {
+    FV_Reverb_setdamp(self, v);
+  } else if (strcmp(param, "wet") == 0) {
+    FV_Reverb_setwet(self, v);
+  } else if (strcmp(param, "dry") == 0) {
+    FV_Reverb_setdry(self, v);
+  } else if (strcmp(param, "width") == 0) {
+    FV_Reverb_setwidth(self, v);
+  } else {
+    return -1;
+  }
+  FV_Reverb_update(self);
+  return 0;
+}
+
+/*
+ * The combs ring longest, each pass of the longest one scales an input by
+ * the room size at most (the damping only takes away), then the input still
+ * has to pass the allpasses in series.
+ */
+uint32_t FV_Reverb_tail(FV_Reverb *self) {
+  uint32_t tail = Effect_feedback_tail(FV_COMBTUNINGL8 + FV_STEREOSPREAD,
+                                       self->roomsize1, FV_Q_BITS,
+                                       EFFECT_TAIL_BITS);
+  for (int i = 0; i < FV_NUMALLPASSES; i++) {
+    tail = Effect_tail_add(
+        tail, Effect_feedback_tail(FV_allpasstuning[i] + FV_STEREOSPREAD,
+                                   self->left.allpass[i].feedback,
+                                   FV_Q_BITS, EFFECT_TAIL_BITS));
   }
+  return tail;
 }
+
+void FV_Reverb_free(FV_Reverb *self) {
+  if (self != NULL) {
+    free(self);
+  }
+}
+
+static void FV_Reverb_effect_process(void *self, int32_t *buf,
+                                     unsigned int nr_samples) {
+  FV_Reverb_process((FV_Reverb *)self, buf, nr_samples);
+}
+
+static int FV_Reverb_effect_set_param(void *self, const char *param,
+                                      float value) {
+  return FV_Reverb_set_param((FV_Reverb *)self, param, value);
+}
+
+static void FV_Reverb_effect_reset(void *self) {
+  FV_Reverb_reset((FV_Reverb *)self);
+}
+
+static uint32_t FV_Reverb_effect_tail(void *self) {
+  return FV_Reverb_tail((FV_Reverb *)self);
+}
+
+// the reverb has no time based state
+static void FV_Reverb_effect_advance(void *self, uint32_t n) {}
+
+const EffectOps FV_Reverb_ops = {"freeverb", FV_Reverb_effect_process,
+                                 FV_Reverb_effect_set_param,
+                                 FV_Reverb_effect_reset,
+                                 FV_Reverb_effect_tail,
+                                 FV_Reverb_effect_advance};
+
+#endif
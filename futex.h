@@ -0,0 +1,33 @@
+#ifndef FUTEX_LIB
+#define FUTEX_LIB 1
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Thin wrappers around the futex syscall. Not private, so they also work on
+// words in memory shared between processes.
+
+// sleeps while *addr == value, may return early
+static inline void Futex_wait(_Atomic uint32_t *addr, uint32_t value) {
+  syscall(SYS_futex, addr, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+static inline void Futex_wake(_Atomic uint32_t *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Bumps a counter and wakes its sleeper, the syscall is only made when the
+// other side has announced it is waiting.
+static inline void Futex_ring(_Atomic uint32_t *bell,
+                              _Atomic uint32_t *waiting) {
+  atomic_fetch_add(bell, 1);
+  if (atomic_load(waiting)) {
+    Futex_wake(bell);
+  }
+}
+
+#endif
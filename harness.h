@@ -0,0 +1,161 @@
+#ifndef HARNESS_LIB
+#define HARNESS_LIB 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chain.h"
+#include "fixedpoint.h"
+#include "wav.h"
+
+// Inputs, timing and effect lists shared by the bench and accuracy
+// programs. Inputs are mono Q16.16 samples, as a chain takes them.
+
+#define HARNESS_MAX_SPECS (CHAIN_MAX_EFFECTS + CHAIN_REGISTRY_SIZE)
+
+typedef struct HarnessInput {
+  const char *name;
+  int32_t *samples;
+  unsigned int nr_samples;
+} HarnessInput;
+
+static inline double Harness_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// zeroed, exits when out of memory
+void *Harness_alloc(unsigned int nr_samples, size_t size) {
+  void *samples = calloc(nr_samples, size);
+  if (samples == NULL) {
+    fprintf(stderr, "harness: out of memory\n");
+    exit(1);
+  }
+  return samples;
+}
+
+// the wav file is mixed down to mono, the chain works on a single channel
+int Harness_load_wav(HarnessInput *input, const char *path) {
+  Wav wav;
+  if (Wav_read(path, &wav) != 0) {
+    return -1;
+  }
+  input->name = "wav";
+  input->nr_samples = wav.nr_frames;
+  input->samples = (int32_t *)Harness_alloc(wav.nr_frames, sizeof(int32_t));
+  for (unsigned int i = 0; i < wav.nr_frames; i++) {
+    int32_t sum = 0;
+    for (unsigned int c = 0; c < wav.channels; c++) {
+      sum += wav.samples[i * wav.channels + c];
+    }
+    input->samples[i] = q16_16_int16_to_fp(sum / (int32_t)wav.channels);
+  }
+  Wav_free(&wav);
+  return 0;
+}
+
+// white noise, full scale shifted down by `shift` bits (6 dB each)
+void Harness_noise(HarnessInput *input, unsigned int nr_samples,
+                   unsigned int shift) {
+  uint32_t state = 22222;
+  input->name = "noise";
+  input->nr_samples = nr_samples;
+  input->samples = (int32_t *)Harness_alloc(nr_samples, sizeof(int32_t));
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    state = state * 1664525 + 1013904223;
+    input->samples[i] = q16_16_int16_to_fp((int16_t)(state >> 16) >> shift);
+  }
+}
+
+void Harness_impulse(HarnessInput *input, unsigned int nr_samples) {
+  input->name = "impulse";
+  input->nr_samples = nr_samples;
+  input->samples = (int32_t *)Harness_alloc(nr_samples, sizeof(int32_t));
+  input->samples[0] = q16_16_int16_to_fp(INT16_MAX);
+}
+
+void Harness_silence(HarnessInput *input, unsigned int nr_samples) {
+  input->name = "silence";
+  input->nr_samples = nr_samples;
+  input->samples = (int32_t *)Harness_alloc(nr_samples, sizeof(int32_t));
+}
+
+unsigned int Harness_max_samples(const HarnessInput *inputs,
+                                 unsigned int nr_inputs) {
+  unsigned int max_samples = 0;
+  for (unsigned int i = 0; i < nr_inputs; i++) {
+    if (inputs[i].nr_samples > max_samples) {
+      max_samples = inputs[i].nr_samples;
+    }
+  }
+  return max_samples;
+}
+
+void Harness_free_inputs(HarnessInput *inputs, unsigned int nr_inputs) {
+  for (unsigned int i = 0; i < nr_inputs; i++) {
+    free(inputs[i].samples);
+  }
+}
+
+/**
+ * Render an input through a chain of one effect spec, a block at a time.
+ * @param out Receives the output of the last run.
+ * @return The best wall time of `runs` renders, each on a fresh instance,
+ *         -1 on a bad spec.
+ */
+double Harness_run(const char *spec, const HarnessInput *input,
+                   unsigned int block_size, int runs, int32_t *out) {
+  double best = -1;
+  for (int r = 0; r < runs; r++) {
+    Chain chain;
+    Chain_init(&chain);
+    if (Chain_parse(&chain, 1, (char **)&spec) != 0) {
+      return -1;
+    }
+    memcpy(out, input->samples, input->nr_samples * sizeof(int32_t));
+    double start = Harness_now();
+    for (unsigned int i = 0; i < input->nr_samples; i += block_size) {
+      unsigned int n = input->nr_samples - i;
+      if (n > block_size) {
+        n = block_size;
+      }
+      Chain_process(&chain, out + i, n);
+    }
+    double elapsed = Harness_now() - start;
+    Chain_free(&chain);
+    if (best < 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+/**
+ * The effect specs given on the command line, from argv[first] on, or
+ * every registered effect when there are none.
+ * @param specs Room for HARNESS_MAX_SPECS.
+ */
+unsigned int Harness_specs(int argc, char *argv[], int first,
+                           const char **specs) {
+  unsigned int nr_specs = 0;
+  for (int i = first; i < argc && nr_specs < CHAIN_MAX_EFFECTS; i++) {
+    specs[nr_specs++] = argv[i];
+  }
+  if (nr_specs == 0) {
+    for (unsigned int i = 0; i < CHAIN_REGISTRY_SIZE; i++) {
+      specs[nr_specs++] = Chain_registry[i].ops->name;
+    }
+  }
+  return nr_specs;
+}
+
+// specs with several parameters contain commas and get quoted in CSV
+static inline const char *Harness_quote(const char *spec) {
+  return strchr(spec, ',') != NULL ? "\"" : "";
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -7,22 +8,22 @@
 #include <time.h>
 #include <unistd.h>
 
-#include "bitcrush.h"
-#include "delay.h"
+#include "chain.h"
 #include "fixedpoint.h"
-#include "flanger.h"
-#include "freeverb.h"
-#include "reverb.h"
-#include "tapedelay.h"
+#include "monitor.h"
+#include "pipeline.h"
+#include "render.h"
+#include "server.h"
 
-const int block_size = 8192;
+// samples per block unless -b says otherwise, ~186 ms at 44.1 kHz
+#define DEFAULT_BLOCK_SIZE 8192
+#define MAX_BLOCK_SIZE 65536
 
-#define DO_REVERB 0
-#define DO_BITCRUSH 0
-#define DO_DELAY 0
-#define DO_FLANGER 0
-#define DO_FREEVERB 0
-#define DO_TAPEDELAY 1
+// deadline monitor, filled in by every chain when -m is given
+static Monitor monitor;
+
+// used when no effects are given on the command line
+#define DEFAULT_CHAIN "tapedelay"
 
 int msleep(long msec) {
   struct timespec ts;
@@ -43,118 +44,271 @@ int msleep(long msec) {
   return res;
 }
 
-#if DO_FREEVERB == 1
-FV_Reverb fv_reverb;
-#endif
+void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-b block_size] [-l] [-m] [effect[:param=value,...]]...\n",
+          prog);
+  fprintf(stderr,
+          "       %s -s name [-n streams] [-w workers] [-m] [effect...]\n",
+          prog);
+  fprintf(stderr, "       %s -c name\n", prog);
+  fprintf(stderr,
+          "       %s -i in.wav -o out.wav [-j threads] [effect...]\n",
+          prog);
+  fprintf(stderr, "-m times every block and effect, the timings are printed "
+                  "on SIGUSR1 and at exit\n");
+  fprintf(stderr, "effects:");
+  for (unsigned int i = 0; i < CHAIN_REGISTRY_SIZE; i++) {
+    fprintf(stderr, " %s", Chain_registry[i].ops->name);
+  }
+  fprintf(stderr, "\n");
+}
 
-int main(int argc, char *argv[]) {
-  // Initialize random number generator
-  srand(time(NULL));
+// Dumps the monitor on every SIGUSR1, which the other threads block.
+static void *dump_on_signal(void *arg) {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  for (;;) {
+    int sig;
+    if (sigwait(&signals, &sig) == 0) {
+      Monitor_dump((Monitor *)arg, stderr);
+    }
+  }
+  return NULL;
+}
 
-#if DO_REVERB == 1
-  Reverb *reverb = Reverb_malloc();
-#endif
-#if DO_DELAY == 1
-  Delay *delay = Delay_malloc(0.6);
-#endif
-#if DO_BITCRUSH == 1
-  Bitcrush *bitcrush = Bitcrush_malloc();
-#endif
-#if DO_FLANGER == 1
-  Flanger *flanger = Flanger_malloc(0.2);
-#endif
-#if DO_FREEVERB == 1
-  FV_Reverb_init(&fv_reverb);
-#endif
-#if DO_TAPEDELAY == 1
-  TapeDelay *tapedelay = TapeDelay_malloc(0.89, 15000);
-  TapeDelay_set_feedback(tapedelay, 0.9);
+// Hosts the chain for up to nr_streams clients until SIGINT or SIGTERM,
+// every stream feeds the monitor if there is one.
+static int serve(const char *name, unsigned int nr_streams,
+                 unsigned int nr_workers, int nr_specs, char **specs,
+                 Monitor *monitor) {
+  // the workers inherit the blocked signals, only sigwait below sees them
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  if (monitor != NULL) {
+    sigaddset(&signals, SIGUSR1);
+  }
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  Server server;
+  if (Server_open(&server, name, nr_streams, nr_workers, nr_specs, specs) !=
+      0) {
+    Server_close(&server);
+    return 1;
+  }
+  for (unsigned int s = 0; monitor != NULL && s < server.nr_streams; s++) {
+    Chain_set_monitor(&server.chains[s], monitor);
+  }
+  if (Server_start(&server) != 0) {
+    Server_stop(&server);
+    Server_close(&server);
+    return 1;
+  }
+  fprintf(stderr, "serving %u streams on /dev/shm%s with %u workers\n",
+          server.nr_streams, server.shm_name, server.nr_workers);
 
+  int sig;
+  while (sigwait(&signals, &sig) == 0 && sig == SIGUSR1) {
+    Monitor_dump(monitor, stderr);
+  }
+  Server_stop(&server);
+#ifdef FPFX_TELEMETRY
+  Chain_telemetry_dump(server.chains, server.nr_streams, stderr);
 #endif
+  Server_close(&server);
+  if (monitor != NULL) {
+    Monitor_dump(monitor, stderr);
+  }
+  return 0;
+}
 
-  int iterator = 0;
+// Streams stdin through a server's chain to stdout.
+static int client(const char *name, unsigned int block_size) {
+  ServerClient client;
+  if (ServerClient_connect(&client, name) != 0) {
+    return 1;
+  }
+  int16_t in[block_size];
+  int16_t out[block_size];
+  size_t have = 0;  // bytes in `in`, may end in half a sample
+  int eof = 0;
+  int drained = 0;
   while (true) {
-    iterator++;
-    int16_t buf[block_size];
-    ssize_t in = read(STDIN_FILENO, buf, sizeof(buf));
-    if (in == -1) {
-      /* Error */
-      return 1;
-    }
-    if (in == 0) {
-      /* EOF */
-      break;
+    uint32_t bell = ServerClient_bell(&client);
+    int progress = 0;
+    if (!eof && have < sizeof(in)) {
+      ssize_t r = read(STDIN_FILENO, (char *)in + have, sizeof(in) - have);
+      if (r == -1 && errno != EINTR) {
+        break;
+      }
+      if (r == 0) {
+        eof = 1;
+      }
+      if (r > 0) {
+        have += r;
+      }
+      progress = 1;
     }
 
-    int32_t buf_fp[block_size];
-    for (int i = 0; i < block_size; i++) {
-      buf_fp[i] = q16_16_int16_to_fp(buf[i]);
-    }
-
-    if (iterator == 40) {
-      TapeDelay_set_delay_time(tapedelay, 19000);
-    }
-    if (iterator == 80) {
-      TapeDelay_set_feedback(tapedelay, 0.3);
-    }
-    if (iterator == 90) {
-      TapeDelay_set_delay_time(tapedelay, 500);
+    unsigned int pushed = ServerClient_write(&client, in, have / 2);
+    if (pushed > 0) {
+      have -= pushed * 2;
+      memmove(in, in + pushed, have);
+      progress = 1;
     }
-    if (iterator == 120) {
-      TapeDelay_set_feedback(tapedelay, 0.995);
+    unsigned int got = ServerClient_read(&client, out, block_size);
+    if (got > 0) {
+      if (Pipeline_write_all(STDOUT_FILENO, out, got * 2) != 0) {
+        break;
+      }
+      progress = 1;
     }
-    if (iterator == 130) {
-      TapeDelay_set_delay_time(tapedelay, 12000);
-      TapeDelay_set_feedback(tapedelay, 0.9);
-    }
-    if (iterator == 140) {
-      TapeDelay_set_delay_time(tapedelay, 20000);
-      TapeDelay_set_feedback(tapedelay, 0.93);
+
+    // a trailing odd byte is not a sample and is dropped
+    if (eof && have < 2) {
+      if (!drained) {
+        ServerClient_drain(&client);
+        drained = 1;
+      }
+      if (ServerClient_done(&client)) {
+        ServerClient_close(&client);
+        return 0;
+      }
     }
-    if (iterator == 150) {
-      TapeDelay_set_delay_time(tapedelay, 2000);
-      TapeDelay_set_feedback(tapedelay, 0.95);
+    if (!progress) {
+      ServerClient_wait(&client, bell);
     }
-    // Delay_set_feedback(delay, (float)rand() / (2 * (float)RAND_MAX));
-#if DO_DELAY == 1
-    Delay_process(delay, buf_fp, block_size);
-#endif
-#if DO_REVERB == 1
-    Reverb_process(reverb, buf_fp, block_size);
-#endif
-#if DO_BITCRUSH == 1
-    Bitcrush_process(bitcrush, buf_fp, block_size);
-#endif
-#if DO_FLANGER == 1
-    Flanger_process(flanger, buf_fp, block_size);
-#endif
-#if DO_FREEVERB == 1
-    FV_Reverb_process(&fv_reverb, buf_fp, block_size);
-#endif
-#if DO_TAPEDELAY == 1
-    TapeDelay_process(tapedelay, buf_fp, block_size);
-#endif
+  }
+  // the stream is left claimed so the worker never sees half a session
+  return 1;
+}
 
-    for (int i = 0; i < block_size; i++) {
-      buf[i] = q16_16_fp_to_int16(buf_fp[i]);
+int main(int argc, char *argv[]) {
+  // Initialize random number generator
+  srand(time(NULL));
+
+  const char *serve_name = NULL;
+  const char *connect_name = NULL;
+  const char *in_path = NULL;
+  const char *out_path = NULL;
+  unsigned int nr_streams = 16;
+  unsigned int nr_workers = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int nr_threads = nr_workers;
+  unsigned int block_size = DEFAULT_BLOCK_SIZE;
+  bool report_latency = false;
+  bool monitored = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:c:n:w:i:o:j:b:lmh")) != -1) {
+    switch (opt) {
+      case 's':
+        serve_name = optarg;
+        break;
+      case 'c':
+        connect_name = optarg;
+        break;
+      case 'n':
+        nr_streams = strtoul(optarg, NULL, 10);
+        break;
+      case 'w':
+        nr_workers = strtoul(optarg, NULL, 10);
+        break;
+      case 'i':
+        in_path = optarg;
+        break;
+      case 'o':
+        out_path = optarg;
+        break;
+      case 'j':
+        nr_threads = strtoul(optarg, NULL, 10);
+        break;
+      case 'b':
+        block_size = strtoul(optarg, NULL, 10);
+        break;
+      case 'l':
+        report_latency = true;
+        break;
+      case 'm':
+        monitored = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
     }
+  }
 
-    write(STDOUT_FILENO, buf, in);
+  char *default_specs[] = {DEFAULT_CHAIN};
+  char **specs = argv + optind;
+  int nr_specs = argc - optind;
+  if (nr_specs == 0) {
+    specs = default_specs;
+    nr_specs = 1;
+  }
 
-    // msleep(180);
+  if ((in_path == NULL) != (out_path == NULL) || block_size == 0 ||
+      block_size > MAX_BLOCK_SIZE) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (in_path != NULL) {
+    return Render_wav(in_path, out_path, nr_specs, specs, block_size,
+                      nr_threads) == 0
+               ? 0
+               : 1;
+  }
+  if (connect_name != NULL) {
+    return client(connect_name, block_size);
+  }
+  if (serve_name != NULL) {
+    if (monitored) {
+      Monitor_init(&monitor, EFFECT_SAMPLE_RATE);
+    }
+    return serve(serve_name, nr_streams, nr_workers, nr_specs, specs,
+                 monitored ? &monitor : NULL);
   }
 
-#if DO_REVERB == 1
-  Reverb_free(reverb);
-#endif
-#if DO_DELAY == 1
-  Delay_free(delay);
-#endif
-#if DO_BITCRUSH == 1
-  Bitcrush_free(bitcrush);
-#endif
-#if DO_TAPEDELAY == 1
-  TapeDelay_free(tapedelay);
+  Chain chain;
+  Chain_init(&chain);
+  if (Chain_parse(&chain, nr_specs, specs) != 0) {
+    usage(argv[0]);
+    Chain_free(&chain);
+    return 1;
+  }
+  if (monitored) {
+    // block SIGUSR1 before the pipeline threads start so they inherit it
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    Monitor_init(&monitor, EFFECT_SAMPLE_RATE);
+    Chain_set_monitor(&chain, &monitor);
+    pthread_t dumper;
+    if (pthread_create(&dumper, NULL, dump_on_signal, &monitor) == 0) {
+      pthread_detach(dumper);
+    }
+  }
+
+  PipelineLatency latency;
+  int result = Pipeline_run(&chain, STDIN_FILENO, STDOUT_FILENO, block_size,
+                            report_latency ? &latency : NULL);
+#ifdef FPFX_TELEMETRY
+  Chain_telemetry_dump(&chain, 1, stderr);
 #endif
-  return 0;
+  Chain_free(&chain);
+  if (report_latency && latency.nr_blocks > 0) {
+    // a sample waits for its block to fill, then for the block to come out
+    fprintf(stderr,
+            "latency: %u samples buffered (%.2f ms at %d Hz) + processing "
+            "min %.3f avg %.3f max %.3f ms over %lu blocks\n",
+            block_size, block_size * 1000.0 / EFFECT_SAMPLE_RATE,
+            EFFECT_SAMPLE_RATE, latency.min / 1e6,
+            latency.total / 1e6 / latency.nr_blocks, latency.max / 1e6,
+            latency.nr_blocks);
+  }
+  if (monitored) {
+    Monitor_dump(&monitor, stderr);
+  }
+  return result == 0 ? 0 : 1;
 }
@@ -0,0 +1,171 @@
+#ifndef MONITOR_LIB
+#define MONITOR_LIB 1
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Real-time deadline monitor. A chain with a monitor attached times every
+// effect and the whole block with the monotonic clock and counts the blocks
+// that took longer than the audio they hold. Histograms are updated with
+// relaxed atomics, so any number of threads can feed one monitor and it can
+// be dumped at any time without stopping them.
+
+// 2^3 buckets per doubling, a bucket is at most 12.5% wide
+#define MONITOR_SUB_BITS 3
+#define MONITOR_SUB_BUCKETS (1 << MONITOR_SUB_BITS)
+#define MONITOR_NR_BUCKETS (64 * MONITOR_SUB_BUCKETS)
+#define MONITOR_MAX_EFFECTS 16
+
+typedef struct MonitorHistogram {
+  _Atomic uint32_t counts[MONITOR_NR_BUCKETS];  // by time in nanoseconds
+  _Atomic uint64_t count;
+  _Atomic uint64_t max;
+} MonitorHistogram;
+
+typedef struct Monitor {
+  unsigned int sample_rate;  // sets the deadline of a block
+  unsigned int nr_effects;
+  const char *names[MONITOR_MAX_EFFECTS];
+  MonitorHistogram effects[MONITOR_MAX_EFFECTS];
+  MonitorHistogram blocks;
+  _Atomic uint64_t misses;  // blocks over their deadline
+  _Atomic uint64_t worst_load;  // highest time / deadline, 10000 is 100%
+} Monitor;
+
+static inline uint64_t Monitor_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void Monitor_init(Monitor *monitor, unsigned int sample_rate) {
+  memset(monitor, 0, sizeof(Monitor));
+  monitor->sample_rate = sample_rate;
+}
+
+// names the effects, in chain order, for the dump
+void Monitor_set_effect(Monitor *monitor, unsigned int index,
+                        const char *name) {
+  if (index < MONITOR_MAX_EFFECTS) {
+    monitor->names[index] = name;
+    if (index >= monitor->nr_effects) {
+      monitor->nr_effects = index + 1;
+    }
+  }
+}
+
+// exact below 8 ns, then MONITOR_SUB_BUCKETS buckets per power of two
+static inline unsigned int Monitor_bucket(uint64_t ns) {
+  if (ns < MONITOR_SUB_BUCKETS) {
+    return (unsigned int)ns;
+  }
+  unsigned int e = 63 - __builtin_clzll(ns);
+  unsigned int sub =
+      (ns >> (e - MONITOR_SUB_BITS)) & (MONITOR_SUB_BUCKETS - 1);
+  return (e - MONITOR_SUB_BITS + 1) * MONITOR_SUB_BUCKETS + sub;
+}
+
+// smallest time that falls in a bucket
+static inline uint64_t Monitor_bucket_floor(unsigned int bucket) {
+  if (bucket < MONITOR_SUB_BUCKETS) {
+    return bucket;
+  }
+  unsigned int e = bucket / MONITOR_SUB_BUCKETS + MONITOR_SUB_BITS - 1;
+  uint64_t sub = bucket % MONITOR_SUB_BUCKETS;
+  return (MONITOR_SUB_BUCKETS + sub) << (e - MONITOR_SUB_BITS);
+}
+
+static inline void MonitorHistogram_add(MonitorHistogram *h, uint64_t ns) {
+  atomic_fetch_add_explicit(&h->counts[Monitor_bucket(ns)], 1,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+  uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+  while (ns > max && !atomic_compare_exchange_weak_explicit(
+                         &h->max, &max, ns, memory_order_relaxed,
+                         memory_order_relaxed)) {
+  }
+}
+
+/**
+ * Time at or below which a fraction of the samples fall, the upper edge of
+ * the bucket it lands in.
+ * @param fraction 0..1, e.g. 0.99 for p99.
+ */
+uint64_t MonitorHistogram_percentile(MonitorHistogram *h, double fraction) {
+  uint64_t count = atomic_load_explicit(&h->count, memory_order_relaxed);
+  uint64_t rank = (uint64_t)(fraction * count + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (unsigned int b = 0; b < MONITOR_NR_BUCKETS; b++) {
+    seen += atomic_load_explicit(&h->counts[b], memory_order_relaxed);
+    if (seen >= rank) {
+      uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+      uint64_t edge = Monitor_bucket_floor(b + 1) - 1;
+      return edge < max ? edge : max;
+    }
+  }
+  return atomic_load_explicit(&h->max, memory_order_relaxed);
+}
+
+static inline void Monitor_effect(Monitor *monitor, unsigned int index,
+                                  uint64_t ns) {
+  if (index < MONITOR_MAX_EFFECTS) {
+    MonitorHistogram_add(&monitor->effects[index], ns);
+  }
+}
+
+// a whole block of nr_samples took ns
+static inline void Monitor_block(Monitor *monitor, unsigned int nr_samples,
+                                 uint64_t ns) {
+  MonitorHistogram_add(&monitor->blocks, ns);
+  uint64_t deadline = (uint64_t)nr_samples * 1000000000 / monitor->sample_rate;
+  if (deadline == 0) {
+    return;
+  }
+  if (ns > deadline) {
+    atomic_fetch_add_explicit(&monitor->misses, 1, memory_order_relaxed);
+  }
+  uint64_t load = ns * 10000 / deadline;
+  uint64_t worst =
+      atomic_load_explicit(&monitor->worst_load, memory_order_relaxed);
+  while (load > worst && !atomic_compare_exchange_weak_explicit(
+                             &monitor->worst_load, &worst, load,
+                             memory_order_relaxed, memory_order_relaxed)) {
+  }
+}
+
+static void MonitorHistogram_print(FILE *f, const char *name,
+                                   MonitorHistogram *h) {
+  fprintf(f, "monitor: %-10s p50 %9.3f us  p99 %9.3f us  max %9.3f us\n",
+          name, MonitorHistogram_percentile(h, 0.5) / 1e3,
+          MonitorHistogram_percentile(h, 0.99) / 1e3,
+          atomic_load_explicit(&h->max, memory_order_relaxed) / 1e3);
+}
+
+// prints the block and per-effect timings and the deadline misses
+void Monitor_dump(Monitor *monitor, FILE *f) {
+  uint64_t blocks =
+      atomic_load_explicit(&monitor->blocks.count, memory_order_relaxed);
+  fprintf(f,
+          "monitor: %llu blocks, %llu over their deadline, worst at %.2f%% "
+          "of its deadline\n",
+          (unsigned long long)blocks,
+          (unsigned long long)atomic_load_explicit(&monitor->misses,
+                                                   memory_order_relaxed),
+          atomic_load_explicit(&monitor->worst_load, memory_order_relaxed) /
+              100.0);
+  if (blocks == 0) {
+    return;
+  }
+  MonitorHistogram_print(f, "block", &monitor->blocks);
+  for (unsigned int i = 0; i < monitor->nr_effects; i++) {
+    MonitorHistogram_print(f, monitor->names[i], &monitor->effects[i]);
+  }
+}
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef MultiTapDelay_LIB
+#define MultiTapDelay_LIB 1
+
+#include <stdlib.h>
+
+#include "effect.h"
+#include "fixedpoint.h"
+#include "ringbuffer.h"
+
+#define MULTITAPDELAY_MAX_TAPS 8
+#define MULTITAPDELAY_CHUNK 256
+// fractional bits of the gains and feedback, see FIXEDPOINT_Q_BITS
+#ifndef MULTITAPDELAY_Q_BITS
+#define MULTITAPDELAY_Q_BITS FIXEDPOINT_Q_BITS
+#endif
+
+// Several taps at fractional offsets reading one shared delay line, the
+// longest tap is fed back into it.
+typedef struct MultiTapDelay {
+  Ringbuffer *fb;  // power-of-two delay line shared by all taps
+  unsigned int nr_taps;
+  int32_t delay[MULTITAPDELAY_MAX_TAPS];  // Q16.16 samples
+  int32_t gain[MULTITAPDELAY_MAX_TAPS];   // MULTITAPDELAY_Q_BITS
+  int32_t feedback;                       // MULTITAPDELAY_Q_BITS
+  unsigned int longest;  // index of the tap that is fed back
+} MultiTapDelay;
+
+/**
+ * Set the delay and gain of a tap, taps are numbered from 0 and setting a
+ * tap past the last one adds it.
+ * @param delay Delay in samples, 1 <= delay < max_delay.
+ * @return 0 on success, -1 if the tap or delay is out of range.
+ */
+int MultiTapDelay_set_tap(MultiTapDelay *self, unsigned int tap, float delay,
+                          float gain) {
+  if (tap >= MULTITAPDELAY_MAX_TAPS || delay < 1 ||
+      delay >= self->fb->nr_samples - 1) {
+    return -1;
+  }
+  while (self->nr_taps <= tap) {
+    self->delay[self->nr_taps] = Q16_16_1;
+    self->gain[self->nr_taps] = 0;
+    self->nr_taps++;
+  }
+  self->delay[tap] = q16_16_float_to_fp(delay);
+  self->gain[tap] = q_float_to_fp(gain, MULTITAPDELAY_Q_BITS);
+  self->longest = 0;
+  for (unsigned int t = 1; t < self->nr_taps; t++) {
+    if (self->delay[t] > self->delay[self->longest]) {
+      self->longest = t;
+    }
+  }
+  return 0;
+}
+
+void MultiTapDelay_set_feedback(MultiTapDelay *self, float feedback) {
+  self->feedback = q_float_to_fp(feedback, MULTITAPDELAY_Q_BITS);
+}
+
+MultiTapDelay *MultiTapDelay_alloc(Arena *arena, unsigned int max_delay) {
+  MultiTapDelay *self =
+      (MultiTapDelay *)Arena_alloc(arena, sizeof(MultiTapDelay));
+  Ringbuffer *fb = Ringbuffer_alloc_pow2(arena, max_delay + 2);
+  if (self == NULL || fb == NULL) {
+    return NULL;
+  }
+  self->fb = fb;
+  self->nr_taps = 0;
+  self->longest = 0;
+  self->feedback = 0;
+  return self;
+}
+
+// a single heap block, the MultiTapDelay comes first in it
+MultiTapDelay *MultiTapDelay_malloc(unsigned int max_delay) {
+  Arena arena;
+  Arena_sizing(&arena);
+  MultiTapDelay_alloc(&arena, max_delay);
+  if (Arena_malloc(&arena, arena.used) != 0) {
+    return NULL;
+  }
+  return MultiTapDelay_alloc(&arena, max_delay);
+}
+
+// a tap with no gain that is not fed back adds nothing, taps filled in by
+// setting a later one start out that way
+static inline int MultiTapDelay_audible(const MultiTapDelay *self,
+                                        unsigned int tap) {
+  return self->gain[tap] != 0 ||
+         (tap == self->longest && self->feedback != 0);
+}
+
+void MultiTapDelay_process(MultiTapDelay *self, int32_t *buf,
+                           unsigned int nr_samples) {
+  int32_t wet[MULTITAPDELAY_CHUNK];
+  int32_t tap[MULTITAPDELAY_CHUNK];
+  int32_t fed[MULTITAPDELAY_CHUNK];
+
+  // a pass may not be longer than the shortest tap, or it would read
+  // samples it has not written yet. Silent taps are skipped and don't count.
+  unsigned int chunk = MULTITAPDELAY_CHUNK;
+  for (unsigned int t = 0; t < self->nr_taps; t++) {
+    if (!MultiTapDelay_audible(self, t)) {
+      continue;
+    }
+    unsigned int d = self->delay[t] >> Q16_16_Q_BITS;
+    if (d < chunk) {
+      chunk = d;
+    }
+  }
+
+  for (unsigned int i = 0; i < nr_samples; i += chunk) {
+    unsigned int n = nr_samples - i;
+    if (n > chunk) {
+      n = chunk;
+    }
+    memset(wet, 0, n * sizeof(int32_t));
+    memset(fed, 0, n * sizeof(int32_t));
+    for (unsigned int t = 0; t < self->nr_taps; t++) {
+      if (!MultiTapDelay_audible(self, t)) {
+        continue;
+      }
+      Ringbuffer_tap_frac_block(self->fb, self->delay[t], tap, n);
+      q_mac_block_sat(wet, tap, self->gain[t], MULTITAPDELAY_Q_BITS, n);
+      if (t == self->longest) {
+        q_mac_block_sat(fed, tap, self->feedback, MULTITAPDELAY_Q_BITS, n);
+      }
+    }
+    q16_16_mix_block_sat(fed, buf + i, n);
+    Ringbuffer_write(self->fb, fed, n);
+    q16_16_mix_block_sat(buf + i, wet, n);
+  }
+}
+
+void MultiTapDelay_reset(MultiTapDelay *self) { Ringbuffer_clear(self->fb); }
+
+// the taps read at most the longest delay back, and only the longest tap
+// feeds back
+uint32_t MultiTapDelay_tail(MultiTapDelay *self) {
+  if (self->nr_taps == 0) {
+    return 0;
+  }
+  uint32_t longest = (self->delay[self->longest] >> Q16_16_Q_BITS) + 1;
+  return Effect_feedback_tail(longest, self->feedback, MULTITAPDELAY_Q_BITS,
+                              EFFECT_TAIL_BITS);
+}
+
+// parameters: feedback, delayN and gainN for tap N counting from 1
+int MultiTapDelay_set_param(MultiTapDelay *self, const char *param,
+                            float value) {
+  if (strcmp(param, "feedback") == 0) {
+    MultiTapDelay_set_feedback(self, value);
+    return 0;
+  }
+  if (strncmp(param, "delay", 5) == 0 || strncmp(param, "gain", 4) == 0) {
+    int is_delay = param[0] == 'd';
+    int tap = atoi(param + (is_delay ? 5 : 4)) - 1;
+    if (tap < 0) {
+      return -1;
+    }
+    float delay = 1.0f;
+    float gain = 0.0f;
+    if (tap < (int)self->nr_taps) {
+      delay = q16_16_fp_to_float(self->delay[tap]);
+      gain = q_fp_to_float(self->gain[tap], MULTITAPDELAY_Q_BITS);
+    }
+    return MultiTapDelay_set_tap(self, tap, is_delay ? value : delay,
+                                 is_delay ? gain : value);
+  }
+  return -1;
+}
+
+void MultiTapDelay_free(MultiTapDelay *self) {
+  free(self);
+}
+
+static void MultiTapDelay_effect_process(void *self, int32_t *buf,
+                                         unsigned int nr_samples) {
+  MultiTapDelay_process((MultiTapDelay *)self, buf, nr_samples);
+}
+
+static int MultiTapDelay_effect_set_param(void *self, const char *param,
+                                          float value) {
+  return MultiTapDelay_set_param((MultiTapDelay *)self, param, value);
+}
+
+static void MultiTapDelay_effect_reset(void *self) {
+  MultiTapDelay_reset((MultiTapDelay *)self);
+}
+
+static uint32_t MultiTapDelay_effect_tail(void *self) {
+  return MultiTapDelay_tail((MultiTapDelay *)self);
+}
+
+// the taps are fixed, nothing moves with time
+static void MultiTapDelay_effect_advance(void *self, uint32_t n) {}
+
+const EffectOps MultiTapDelay_ops = {
+    "multitap", MultiTapDelay_effect_process, MultiTapDelay_effect_set_param,
+    MultiTapDelay_effect_reset, MultiTapDelay_effect_tail,
+    MultiTapDelay_effect_advance};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef OSCILLATOR_LIB
+#define OSCILLATOR_LIB 1
+
+#include <math.h>
+#include <stdint.h>
+
+#include "fixedpoint.h"
+
+// Wavetable oscillator for LFOs. The phase is a 32-bit accumulator that
+// wraps on overflow, a full turn is 2^32, so there is no range reduction.
+
+#define OSCILLATOR_TABLE_BITS 10
+#define OSCILLATOR_TABLE_SIZE (1 << OSCILLATOR_TABLE_BITS)
+// phase bits below the table index, the top 16 of them interpolate
+#define OSCILLATOR_FRAC_BITS (32 - OSCILLATOR_TABLE_BITS)
+
+#define OSCILLATOR_SINE 0
+#define OSCILLATOR_TRIANGLE 1
+#define OSCILLATOR_SAW 2
+#define OSCILLATOR_NR_SHAPES 3
+
+// Q16.16 values in -1..1, one extra entry so interpolation never wraps
+int32_t Oscillator_tables[OSCILLATOR_NR_SHAPES][OSCILLATOR_TABLE_SIZE + 1];
+int Oscillator_tables_ready = 0;
+
+typedef struct Oscillator {
+  uint32_t phase;
+  uint32_t increment;  // phase step per sample
+  const int32_t *table;
+} Oscillator;
+
+// Fills the tables, called by Oscillator_init. The sine comes from libm and
+// is rounded to Q16.16, the others are exact in integer arithmetic.
+void Oscillator_init_tables(void) {
+  if (Oscillator_tables_ready) {
+    return;
+  }
+  for (int i = 0; i <= OSCILLATOR_TABLE_SIZE; i++) {
+    // position in the turn, Q16.16 in 0..1
+    int32_t turn = (int32_t)(((int64_t)i << Q16_16_Q_BITS) >>
+                             OSCILLATOR_TABLE_BITS);
+    Oscillator_tables[OSCILLATOR_SINE][i] = (int32_t)lrint(
+        sin(2 * M_PI * i / OSCILLATOR_TABLE_SIZE) * Q16_16_1);
+    // triangle starts at 0 and rises, like the sine
+    int32_t tri = 4 * turn;
+    if (turn > Q16_16_0_5 + Q16_16_0_5 / 2) {
+      tri -= 4 * Q16_16_1;
+    } else if (turn > Q16_16_0_5 / 2) {
+      tri = 2 * Q16_16_1 - tri;
+    }
+    Oscillator_tables[OSCILLATOR_TRIANGLE][i] = tri;
+    // saw rises from -1 to 1 over the turn
+    Oscillator_tables[OSCILLATOR_SAW][i] = 2 * turn - Q16_16_1;
+  }
+  Oscillator_tables_ready = 1;
+}
+
+/**
+ * Initialize an oscillator at phase 0.
+ * @param shape OSCILLATOR_SINE, OSCILLATOR_TRIANGLE or OSCILLATOR_SAW.
+ */
+void Oscillator_init(Oscillator *osc, int shape) {
+  Oscillator_init_tables();
+  osc->phase = 0;
+  osc->increment = 0;
+  osc->table = Oscillator_tables[shape];
+}
+
+// a step of turns per sample, >= 0, as a phase increment. Whole turns wrap
+// away, a period of 1 sample steps a full turn and the phase stands still.
+static inline uint32_t Oscillator_increment(double turns) {
+  return (uint32_t)(uint64_t)(turns * 4294967296.0);
+}
+
+// period in samples, >= 1, the phase is kept
+void Oscillator_set_period(Oscillator *osc, float period) {
+  osc->increment = Oscillator_increment(1.0 / period);
+}
+
+// 0 <= frequency <= sample_rate
+void Oscillator_set_frequency(Oscillator *osc, float frequency,
+                              float sample_rate) {
+  osc->increment = Oscillator_increment((double)frequency / sample_rate);
+}
+
+// table value at a phase, linearly interpolated
+static inline int32_t Oscillator_lookup(const int32_t *table, uint32_t phase) {
+  uint32_t index = phase >> OSCILLATOR_FRAC_BITS;
+  int32_t frac = (int32_t)((phase >> (OSCILLATOR_FRAC_BITS - Q16_16_Q_BITS)) &
+                           (Q16_16_1 - 1));
+  int32_t a = table[index];
+  return a + q16_16_multiply(table[index + 1] - a, frac);
+}
+
+// next value in -1..1
+static inline int32_t Oscillator_next(Oscillator *osc) {
+  int32_t value = Oscillator_lookup(osc->table, osc->phase);
+  osc->phase += osc->increment;
+  return value;
+}
+
+/**
+ * Fill out with the next n values scaled around a center,
+ * center + value * amount, e.g. a modulated delay time.
+ */
+void Oscillator_process(Oscillator *osc, int32_t *out, unsigned int n,
+                        int32_t center, int32_t amount) {
+  const int32_t *table = osc->table;
+  uint32_t phase = osc->phase;
+  uint32_t increment = osc->increment;
+  for (unsigned int i = 0; i < n; i++) {
+    out[i] = center + q16_16_multiply(Oscillator_lookup(table, phase), amount);
+    phase += increment;
+  }
+  osc->phase = phase;
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef PIPELINE_LIB
+#define PIPELINE_LIB 1
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chain.h"
+#include "fixedpoint.h"
+#include "spsc.h"
+
+// Runs a chain over a raw int16 stream with three threads: a reader that
+// fills whole blocks from the input, the DSP on the calling thread and a
+// writer. Blocks are preallocated and circulate through three queues,
+// free -> filled -> processed -> free, so a stalled read or write only
+// delays the DSP once every block is in flight.
+
+// blocks in flight, at most SPSC_CAPACITY
+#define PIPELINE_NR_BLOCKS 8
+
+typedef struct PipelineBlock {
+  int16_t *samples;
+  unsigned int nr_samples;
+  int last;           // end of input, no blocks follow
+  uint64_t ready_ns;  // when the block's last input sample was read
+} PipelineBlock;
+
+// Time from a block's last input sample being read to its output being
+// written, in nanoseconds. On top of it every sample waits up to a block
+// for the block to fill.
+typedef struct PipelineLatency {
+  uint64_t min;
+  uint64_t max;
+  uint64_t total;
+  unsigned long nr_blocks;
+} PipelineLatency;
+
+typedef struct Pipeline {
+  Chain *chain;
+  int in_fd;
+  int out_fd;
+  unsigned int block_size;
+  PipelineBlock blocks[PIPELINE_NR_BLOCKS];
+  Spsc free_blocks;
+  Spsc filled;
+  Spsc processed;
+  int read_error;
+  int write_error;
+  PipelineLatency *latency;  // NULL when not measured
+} Pipeline;
+
+static inline uint64_t Pipeline_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// writes all of buf, returns -1 on error
+int Pipeline_write_all(int fd, const void *buf, size_t size) {
+  const char *p = (const char *)buf;
+  while (size > 0) {
+    ssize_t out = write(fd, p, size);
+    if (out == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    p += out;
+    size -= out;
+  }
+  return 0;
+}
+
+// Reads until a block is full, so short reads never reach the chain. Only
+// the last block is short; a trailing odd byte is not a sample and dropped.
+static void *Pipeline_reader(void *arg) {
+  Pipeline *p = (Pipeline *)arg;
+  size_t size = p->block_size * sizeof(int16_t);
+  for (;;) {
+    PipelineBlock *block = (PipelineBlock *)Spsc_pop(&p->free_blocks);
+    size_t have = 0;
+    while (have < size) {
+      ssize_t in = read(p->in_fd, (char *)block->samples + have, size - have);
+      if (in == -1 && errno == EINTR) {
+        continue;
+      }
+      if (in == -1) {
+        p->read_error = 1;
+        break;
+      }
+      if (in == 0) {
+        break;
+      }
+      have += in;
+    }
+    block->nr_samples = have / sizeof(int16_t);
+    block->last = have < size;
+    if (p->latency != NULL) {
+      block->ready_ns = Pipeline_now_ns();
+    }
+    Spsc_push(&p->filled, block);
+    if (block->last) {
+      return NULL;
+    }
+  }
+}
+
+static void *Pipeline_writer(void *arg) {
+  Pipeline *p = (Pipeline *)arg;
+  for (;;) {
+    PipelineBlock *block = (PipelineBlock *)Spsc_pop(&p->processed);
+    // after an error the blocks keep circulating so nothing waits forever
+    if (!p->write_error &&
+        Pipeline_write_all(p->out_fd, block->samples,
+                           block->nr_samples * sizeof(int16_t)) != 0) {
+      p->write_error = 1;
+    }
+    if (p->latency != NULL && block->nr_samples > 0) {
+      uint64_t latency = Pipeline_now_ns() - block->ready_ns;
+      PipelineLatency *l = p->latency;
+      if (l->nr_blocks == 0 || latency < l->min) {
+        l->min = latency;
+      }
+      if (latency > l->max) {
+        l->max = latency;
+      }
+      l->total += latency;
+      l->nr_blocks++;
+    }
+    int last = block->last;
+    Spsc_push(&p->free_blocks, block);
+    if (last) {
+      return NULL;
+    }
+  }
+}
+
+/**
+ * Stream in_fd through the chain to out_fd until the end of the input.
+ * @param latency Filled in with the measured block latency, or NULL.
+ * @return 0 on success, -1 on a read, write or thread error.
+ */
+int Pipeline_run(Chain *chain, int in_fd, int out_fd, unsigned int block_size,
+                 PipelineLatency *latency) {
+  Pipeline p;
+  p.chain = chain;
+  p.in_fd = in_fd;
+  p.out_fd = out_fd;
+  p.block_size = block_size;
+  p.read_error = 0;
+  p.write_error = 0;
+  p.latency = latency;
+  if (latency != NULL) {
+    memset(latency, 0, sizeof(PipelineLatency));
+  }
+  Spsc_init(&p.free_blocks);
+  Spsc_init(&p.filled);
+  Spsc_init(&p.processed);
+
+  // every block and the DSP work buffer in one allocation
+  int32_t *work = (int32_t *)malloc(
+      block_size * (sizeof(int32_t) + PIPELINE_NR_BLOCKS * sizeof(int16_t)));
+  if (work == NULL) {
+    return -1;
+  }
+  int16_t *samples = (int16_t *)(work + block_size);
+  for (int b = 0; b < PIPELINE_NR_BLOCKS; b++) {
+    p.blocks[b].samples = samples + b * block_size;
+    Spsc_push(&p.free_blocks, &p.blocks[b]);
+  }
+
+  pthread_t reader, writer;
+  if (pthread_create(&writer, NULL, Pipeline_writer, &p) != 0) {
+    free(work);
+    return -1;
+  }
+  int have_reader = pthread_create(&reader, NULL, Pipeline_reader, &p) == 0;
+  if (!have_reader) {
+    // end the stream right away so the writer still finishes
+    PipelineBlock *block = (PipelineBlock *)Spsc_pop(&p.free_blocks);
+    block->nr_samples = 0;
+    block->last = 1;
+    p.read_error = 1;
+    Spsc_push(&p.filled, block);
+  }
+
+  for (;;) {
+    PipelineBlock *block = (PipelineBlock *)Spsc_pop(&p.filled);
+    unsigned int n = block->nr_samples;
+    q16_16_int16_to_fp_block(work, block->samples, n);
+    Chain_process(chain, work, n);
+    q16_16_fp_to_int16_block(block->samples, work, n);
+    int last = block->last;
+    Spsc_push(&p.processed, block);
+    if (last) {
+      break;
+    }
+  }
+
+  if (have_reader) {
+    pthread_join(reader, NULL);
+  }
+  pthread_join(writer, NULL);
+  free(work);
+  return p.read_error || p.write_error ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,599 @@
+#ifndef REFERENCE_LIB
+#define REFERENCE_LIB 1
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chain.h"
+#include "freeverb.h"
+
+// Floating point reference implementations of every effect, for measuring
+// the fixed-point ones against (see accuracy.c). Each one runs the same
+// algorithm with the same defaults and parameters as the effect of the same
+// name, sample by sample in float, and saturates wherever the fixed-point
+// effect does by design, so only the rounding differs. Samples are floats,
+// full scale is 1. They are slow and allocate on the heap, they are not
+// meant for real-time use.
+
+typedef struct ReferenceOps {
+  const char *name;  // the effect it models, as in Chain_registry
+  void *(*create)(void);  // with the defaults of Chain_new_<name>
+  void (*process)(void *self, float *buf, unsigned int nr_samples);
+  // returns 0 on success, -1 if the parameter is unknown or out of range
+  int (*set_param)(void *self, const char *param, float value);
+  void (*free)(void *self);
+} ReferenceOps;
+
+// the range of a Q16.16 sample, where the saturating stages clamp
+static inline float Reference_clamp(float x) {
+  return x > 1.0f ? 1.0f : (x < -1.0f ? -1.0f : x);
+}
+
+/* delay */
+
+typedef struct RefDelay {
+  float *line;
+  unsigned int nr_samples;
+  unsigned int pos;
+  unsigned int time;
+  float feedback;
+  float bpm;
+  float beats;
+} RefDelay;
+
+static void *RefDelay_create(void) {
+  RefDelay *self = (RefDelay *)malloc(sizeof(RefDelay));
+  if (self == NULL) {
+    return NULL;
+  }
+  self->nr_samples = DELAY_MAX_MS * EFFECT_SAMPLE_RATE / 1000;
+  self->line = (float *)calloc(self->nr_samples, sizeof(float));
+  if (self->line == NULL) {
+    free(self);
+    return NULL;
+  }
+  self->pos = 0;
+  self->time = DELAY_DEFAULT_TIME;
+  self->feedback = 0.6f;
+  self->bpm = 0;
+  self->beats = 1;
+  return self;
+}
+
+static int RefDelay_set_time(RefDelay *self, float samples) {
+  if (!(samples >= 0.5f) || samples >= self->nr_samples + 0.5f) {
+    return -1;
+  }
+  self->time = (unsigned int)(samples + 0.5f);
+  return 0;
+}
+
+static int RefDelay_set_time_bpm(RefDelay *self, float bpm, float beats) {
+  if (!(bpm > 0)) {
+    return -1;
+  }
+  return RefDelay_set_time(self, Delay_bpm_to_samples(bpm, beats));
+}
+
+static void RefDelay_process(void *p, float *buf, unsigned int nr_samples) {
+  RefDelay *self = (RefDelay *)p;
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    unsigned int tap = self->pos >= self->time
+                           ? self->pos - self->time
+                           : self->pos + self->nr_samples - self->time;
+    float y = Reference_clamp(
+        buf[i] + Reference_clamp(self->line[tap] * self->feedback));
+    self->line[self->pos] = y;
+    buf[i] = y;
+    if (++self->pos == self->nr_samples) {
+      self->pos = 0;
+    }
+  }
+}
+
+static int RefDelay_set_param(void *p, const char *param, float value) {
+  RefDelay *self = (RefDelay *)p;
+  if (strcmp(param, "feedback") == 0) {
+    self->feedback = value;
+    return 0;
+  }
+  if (strcmp(param, "time") == 0) {
+    return RefDelay_set_time(self, value);
+  }
+  if (strcmp(param, "ms") == 0) {
+    return RefDelay_set_time(self, Delay_ms_to_samples(value));
+  }
+  // the reference always has the longest line, the fixed-point delay
+  // checks the spec's times against its own
+  if (strcmp(param, "max") == 0 || strcmp(param, "max_ms") == 0) {
+    float samples = param[3] == '\0' ? value : Delay_ms_to_samples(value);
+    return samples >= 0.5f && samples < self->nr_samples + 0.5f ? 0 : -1;
+  }
+  if (strcmp(param, "bpm") == 0 && value > 0) {
+    if (RefDelay_set_time_bpm(self, value, self->beats) != 0) {
+      return -1;
+    }
+    self->bpm = value;
+    return 0;
+  }
+  if (strcmp(param, "beats") == 0 && value > 0) {
+    if (self->bpm > 0 && RefDelay_set_time_bpm(self, self->bpm, value) != 0) {
+      return -1;
+    }
+    self->beats = value;
+    return 0;
+  }
+  return -1;
+}
+
+static void RefDelay_free(void *p) {
+  RefDelay *self = (RefDelay *)p;
+  free(self->line);
+  free(self);
+}
+
+const ReferenceOps RefDelay_ops = {"delay", RefDelay_create, RefDelay_process,
+                                   RefDelay_set_param, RefDelay_free};
+
+/* reverb */
+
+typedef struct RefReverb {
+  float line[REVERB_LENGTH];
+  unsigned int pos;
+} RefReverb;
+
+static void *RefReverb_create(void) {
+  return calloc(1, sizeof(RefReverb));
+}
+
+static void RefReverb_process(void *p, float *buf, unsigned int nr_samples) {
+  RefReverb *self = (RefReverb *)p;
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    float x = buf[i] / 8;
+    for (int t = 0; t < REVERB_NUMTAPS; t++) {
+      unsigned int d = Reverb_taps[t];
+      unsigned int tap =
+          self->pos >= d ? self->pos - d : self->pos + REVERB_LENGTH - d;
+      x += self->line[tap] / 8;
+    }
+    self->line[self->pos] = x;
+    buf[i] = Reference_clamp(x * 8);
+    if (++self->pos == REVERB_LENGTH) {
+      self->pos = 0;
+    }
+  }
+}
+
+static int RefReverb_set_param(void *p, const char *param, float value) {
+  return -1;
+}
+
+const ReferenceOps RefReverb_ops = {"reverb", RefReverb_create,
+                                    RefReverb_process, RefReverb_set_param,
+                                    free};
+
+/* bitcrush */
+
+typedef struct RefBitcrush {
+  float step;  // quantization step, 2^(1 - bits)
+  float reduce;
+  float countdown;
+  float held;
+} RefBitcrush;
+
+static void *RefBitcrush_create(void) {
+  RefBitcrush *self = (RefBitcrush *)calloc(1, sizeof(RefBitcrush));
+  if (self != NULL) {
+    self->step = ldexpf(1, 1 - 8);
+    self->reduce = 5;
+  }
+  return self;
+}
+
+static void RefBitcrush_process(void *p, float *buf,
+                                unsigned int nr_samples) {
+  RefBitcrush *self = (RefBitcrush *)p;
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    if (self->countdown <= 0) {
+      // the mask rounds towards minus infinity
+      self->held = floorf(buf[i] / self->step) * self->step;
+      self->countdown += self->reduce;
+    }
+    buf[i] = self->held;
+    self->countdown -= 1;
+  }
+}
+
+static int RefBitcrush_set_param(void *p, const char *param, float value) {
+  RefBitcrush *self = (RefBitcrush *)p;
+  if (strcmp(param, "bits") == 0 && value >= 1 && value <= 16) {
+    self->step = ldexpf(1, 1 - (int)value);
+    return 0;
+  }
+  if (strcmp(param, "reduce") == 0 && value >= 1 && value <= 4096) {
+    self->reduce = value;
+    if (self->countdown > value) {
+      self->countdown = value;
+    }
+    return 0;
+  }
+  return -1;
+}
+
+const ReferenceOps RefBitcrush_ops = {"bitcrush", RefBitcrush_create,
+                                      RefBitcrush_process,
+                                      RefBitcrush_set_param, free};
+
+/* flanger, the LFO is an exact sine */
+
+#define REFFLANGER_LENGTH 1024  // FLANGER_MAX_DELAY + 2, a power of two
+
+typedef struct RefFlanger {
+  float line[REFFLANGER_LENGTH];
+  unsigned int pos;
+  double phase;  // in turns
+  double period;
+  float sweep;  // depth * 400 samples
+  float feedback;
+} RefFlanger;
+
+static void *RefFlanger_create(void) {
+  RefFlanger *self = (RefFlanger *)calloc(1, sizeof(RefFlanger));
+  if (self != NULL) {
+    self->period = 512;
+    self->sweep = 0.5f * 400;
+    self->feedback = 0.2f;
+  }
+  return self;
+}
+
+static void RefFlanger_process(void *p, float *buf, unsigned int nr_samples) {
+  RefFlanger *self = (RefFlanger *)p;
+  const unsigned int mask = REFFLANGER_LENGTH - 1;
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    double delay = 1 + self->sweep / 2 +
+                   sin(2 * M_PI * self->phase) * (self->sweep / 2);
+    unsigned int d = (unsigned int)delay;
+    float frac = (float)(delay - d);
+    float a = self->line[(self->pos - d) & mask];
+    float b = self->line[(self->pos - d - 1) & mask];
+    float delayed = a + (b - a) * frac;
+
+    float fed = Reference_clamp(self->feedback * delayed);
+    self->line[self->pos] = Reference_clamp(buf[i] + fed);
+    self->pos = (self->pos + 1) & mask;
+    buf[i] = (buf[i] + delayed) / 2;
+
+    self->phase += 1 / self->period;
+    self->phase -= floor(self->phase);
+  }
+}
+
+static int RefFlanger_set_param(void *p, const char *param, float value) {
+  RefFlanger *self = (RefFlanger *)p;
+  if (strcmp(param, "feedback") == 0) {
+    self->feedback = value;
+    return 0;
+  }
+  if (strcmp(param, "depth") == 0 && value >= 0 && value <= 1) {
+    self->sweep = value * 400;
+    return 0;
+  }
+  if (strcmp(param, "rate") == 0 && value >= 1) {
+    self->period = value;
+    return 0;
+  }
+  return -1;
+}
+
+const ReferenceOps RefFlanger_ops = {"flanger", RefFlanger_create,
+                                     RefFlanger_process, RefFlanger_set_param,
+                                     free};
+
+/* tape delay */
+
+#define REFTAPEDELAY_LENGTH 22000
+
+// a linear ramp to a target, like Slew
+typedef struct RefSlew {
+  double current;
+  double target;
+  double step;
+  unsigned int remaining;
+} RefSlew;
+
+static void RefSlew_set_target(RefSlew *slew, double target,
+                               unsigned int steps) {
+  slew->target = target;
+  slew->remaining = steps;
+  if (steps > 0) {
+    slew->step = (target - slew->current) / steps;
+  } else {
+    slew->current = target;
+    slew->step = 0;
+  }
+}
+
+static inline double RefSlew_next(RefSlew *slew) {
+  if (slew->remaining > 0) {
+    slew->current += slew->step;
+    slew->remaining--;
+  } else {
+    slew->current = slew->target;
+  }
+  return slew->current;
+}
+
+typedef struct RefTapeDelay {
+  float line[REFTAPEDELAY_LENGTH];
+  unsigned int pos;
+  double previous_delay_time;
+  unsigned int slew_steps;
+  RefSlew feedback;
+  RefSlew delay_time;
+} RefTapeDelay;
+
+static void *RefTapeDelay_create(void) {
+  RefTapeDelay *self = (RefTapeDelay *)calloc(1, sizeof(RefTapeDelay));
+  if (self == NULL) {
+    return NULL;
+  }
+  // both glide up from 0, the feedback is retargeted once as in the chain
+  self->slew_steps = Slew_ms_to_steps(TAPEDELAY_SLEW_MS, EFFECT_SAMPLE_RATE);
+  RefSlew_set_target(&self->feedback, 0.89, self->slew_steps);
+  RefSlew_set_target(&self->feedback, 0.9f, self->slew_steps);
+  RefSlew_set_target(&self->delay_time, 15000, self->slew_steps);
+  return self;
+}
+
+// the curve tanh_approx follows
+static inline float RefTapeDelay_saturate(float x) {
+  if (x > 3) {
+    x = 3;
+  } else if (x < -3) {
+    x = -3;
+  }
+  return Reference_clamp(x * (27 + x * x) / (27 + 9 * x * x));
+}
+
+static void RefTapeDelay_process(void *p, float *buf,
+                                 unsigned int nr_samples) {
+  RefTapeDelay *self = (RefTapeDelay *)p;
+  const double threshold = TAPEDELAY_GLIDE_THRESHOLD / 65536.0;
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    float feedback = (float)RefSlew_next(&self->feedback);
+    double delay_time = RefSlew_next(&self->delay_time);
+
+    double read = self->pos - delay_time;
+    double change = delay_time - self->previous_delay_time;
+    if (change > threshold || change < -threshold) {
+      read += change / 2;
+      self->previous_delay_time = delay_time;
+    }
+    if (read < 0) {
+      read += REFTAPEDELAY_LENGTH;
+    } else if (read >= REFTAPEDELAY_LENGTH) {
+      read -= REFTAPEDELAY_LENGTH;
+    }
+    unsigned int base = (unsigned int)read;
+    unsigned int next = base + 1 == REFTAPEDELAY_LENGTH ? 0 : base + 1;
+    float frac = (float)(read - base);
+    float delayed =
+        self->line[base] + (self->line[next] - self->line[base]) * frac;
+
+    float y = RefTapeDelay_saturate(
+        buf[i] + Reference_clamp(feedback * delayed));
+    self->line[self->pos] = y;
+    buf[i] = y;
+    if (++self->pos == REFTAPEDELAY_LENGTH) {
+      self->pos = 0;
+    }
+  }
+}
+
+static int RefTapeDelay_set_param(void *p, const char *param, float value) {
+  RefTapeDelay *self = (RefTapeDelay *)p;
+  if (strcmp(param, "feedback") == 0) {
+    RefSlew_set_target(&self->feedback, value, self->slew_steps);
+    return 0;
+  }
+  if (strcmp(param, "time") == 0 && value >= 1 &&
+      value < REFTAPEDELAY_LENGTH - 1) {
+    RefSlew_set_target(&self->delay_time, value, self->slew_steps);
+    return 0;
+  }
+  if (strcmp(param, "slew") == 0 && value >= 0) {
+    self->slew_steps = Slew_ms_to_steps(value, EFFECT_SAMPLE_RATE);
+    return 0;
+  }
+  return -1;
+}
+
+const ReferenceOps RefTapeDelay_ops = {"tapedelay", RefTapeDelay_create,
+                                       RefTapeDelay_process,
+                                       RefTapeDelay_set_param, free};
+
+/* multitap delay */
+
+#define REFMULTITAP_LENGTH 32768  // 32766 + 2 rounded up to a power of two
+
+typedef struct RefMultiTap {
+  float line[REFMULTITAP_LENGTH];
+  unsigned int pos;
+  unsigned int nr_taps;
+  float delay[MULTITAPDELAY_MAX_TAPS];
+  float gain[MULTITAPDELAY_MAX_TAPS];
+  float feedback;
+  unsigned int longest;
+} RefMultiTap;
+
+static int RefMultiTap_set_tap(RefMultiTap *self, unsigned int tap,
+                               float delay, float gain) {
+  if (tap >= MULTITAPDELAY_MAX_TAPS || delay < 1 ||
+      delay >= REFMULTITAP_LENGTH - 1) {
+    return -1;
+  }
+  while (self->nr_taps <= tap) {
+    self->delay[self->nr_taps] = 1;
+    self->gain[self->nr_taps] = 0;
+    self->nr_taps++;
+  }
+  self->delay[tap] = delay;
+  self->gain[tap] = gain;
+  self->longest = 0;
+  for (unsigned int t = 1; t < self->nr_taps; t++) {
+    if (self->delay[t] > self->delay[self->longest]) {
+      self->longest = t;
+    }
+  }
+  return 0;
+}
+
+static void *RefMultiTap_create(void) {
+  RefMultiTap *self = (RefMultiTap *)calloc(1, sizeof(RefMultiTap));
+  if (self != NULL) {
+    RefMultiTap_set_tap(self, 0, 5512.5, 0.7);
+    RefMultiTap_set_tap(self, 1, 11025, 0.5);
+    RefMultiTap_set_tap(self, 2, 16537.5, 0.35);
+    self->feedback = 0.3f;
+  }
+  return self;
+}
+
+static void RefMultiTap_process(void *p, float *buf,
+                                unsigned int nr_samples) {
+  RefMultiTap *self = (RefMultiTap *)p;
+  const unsigned int mask = REFMULTITAP_LENGTH - 1;
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    float wet = 0;
+    float fed = 0;
+    for (unsigned int t = 0; t < self->nr_taps; t++) {
+      unsigned int d = (unsigned int)self->delay[t];
+      float frac = self->delay[t] - d;
+      float a = self->line[(self->pos - d) & mask];
+      float b = self->line[(self->pos - d - 1) & mask];
+      float tap = a + (b - a) * frac;
+      wet = Reference_clamp(wet + Reference_clamp(tap * self->gain[t]));
+      if (t == self->longest) {
+        fed = Reference_clamp(tap * self->feedback);
+      }
+    }
+    self->line[self->pos] = Reference_clamp(fed + buf[i]);
+    self->pos = (self->pos + 1) & mask;
+    buf[i] = Reference_clamp(buf[i] + wet);
+  }
+}
+
+static int RefMultiTap_set_param(void *p, const char *param, float value) {
+  RefMultiTap *self = (RefMultiTap *)p;
+  if (strcmp(param, "feedback") == 0) {
+    self->feedback = value;
+    return 0;
+  }
+  if (strncmp(param, "delay", 5) == 0 || strncmp(param, "gain", 4) == 0) {
+    int is_delay = param[0] == 'd';
+    int tap = atoi(param + (is_delay ? 5 : 4)) - 1;
+    if (tap < 0) {
+      return -1;
+    }
+    float delay = 1.0f;
+    float gain = 0.0f;
+    if (tap < (int)self->nr_taps) {
+      delay = self->delay[tap];
+      gain = self->gain[tap];
+    }
+    return RefMultiTap_set_tap(self, tap, is_delay ? value : delay,
+                               is_delay ? gain : value);
+  }
+  return -1;
+}
+
+const ReferenceOps RefMultiTap_ops = {"multitap", RefMultiTap_create,
+                                      RefMultiTap_process,
+                                      RefMultiTap_set_param, free};
+
+/* freeverb, the original float code in freeverb.h */
+
+static void *RefFreeverb_create(void) { return FVF_Reverb_malloc(FVF_MONO); }
+
+static void RefFreeverb_process(void *self, float *buf,
+                                unsigned int nr_samples) {
+  FVF_Reverb_process((FVF_Reverb *)self, buf, nr_samples);
+}
+
+static int RefFreeverb_set_param(void *self, const char *param, float value) {
+  return FVF_Reverb_set_param((FVF_Reverb *)self, param, value);
+}
+
+static void RefFreeverb_free(void *self) {
+  FVF_Reverb_free((FVF_Reverb *)self);
+}
+
+const ReferenceOps RefFreeverb_ops = {"freeverb", RefFreeverb_create,
+                                      RefFreeverb_process,
+                                      RefFreeverb_set_param, RefFreeverb_free};
+
+const ReferenceOps *Reference_registry[] = {
+    &RefDelay_ops,       &RefReverb_ops,    &RefBitcrush_ops,
+    &RefFlanger_ops,     &RefFreeverb_ops,  &RefTapeDelay_ops,
+    &RefMultiTap_ops,
+};
+
+#define REFERENCE_REGISTRY_SIZE \
+  (sizeof(Reference_registry) / sizeof(Reference_registry[0]))
+
+typedef struct Reference {
+  const ReferenceOps *ops;
+  void *self;
+} Reference;
+
+/**
+ * Create the reference of an effect spec, as Chain_add takes it.
+ * @return 0 on success, -1 on an unknown effect or parameter.
+ */
+int Reference_new(Reference *ref, const char *spec) {
+  char name[CHAIN_MAX_SPEC];
+  if (strlen(spec) >= CHAIN_MAX_SPEC) {
+    fprintf(stderr, "reference: spec too long: %s\n", spec);
+    return -1;
+  }
+  strcpy(name, spec);
+  char *params = strchr(name, ':');
+  if (params != NULL) {
+    *params++ = '\0';
+  }
+
+  ref->ops = NULL;
+  ref->self = NULL;
+  for (unsigned int i = 0; i < REFERENCE_REGISTRY_SIZE; i++) {
+    if (strcmp(Reference_registry[i]->name, name) == 0) {
+      ref->ops = Reference_registry[i];
+    }
+  }
+  if (ref->ops == NULL) {
+    fprintf(stderr, "reference: no reference for '%s'\n", name);
+    return -1;
+  }
+  ref->self = ref->ops->create();
+  if (ref->self == NULL) {
+    fprintf(stderr, "reference: out of memory\n");
+    return -1;
+  }
+  return Chain_set_params(ref->self, ref->ops->set_param, name, params);
+}
+
+static inline void Reference_process(Reference *ref, float *buf,
+                                     unsigned int nr_samples) {
+  ref->ops->process(ref->self, buf, nr_samples);
+}
+
+void Reference_free(Reference *ref) {
+  if (ref->self != NULL) {
+    ref->ops->free(ref->self);
+    ref->self = NULL;
+  }
+}
+
+#endif
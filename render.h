@@ -0,0 +1,209 @@
+#ifndef RENDER_LIB
+#define RENDER_LIB 1
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chain.h"
+#include "fixedpoint.h"
+#include "wav.h"
+
+// Offline rendering of a wav file to a wav file. Both files are mapped, the
+// chain reads the input samples and writes the output samples in place of
+// any read/write copies. Every channel runs through its own chain.
+//
+// Long files are cut into one chunk per thread. A chunk's chains start
+// silent, so each one first renders the chain's tail worth of frames before
+// the chunk and throws them away, by then anything left over from before
+// has died out below 1 LSB. A chain whose tail is unbounded, or longer than
+// a chunk, renders serially instead.
+
+// one channel of a block of frames through its chain, out NULL discards
+// the result
+static void Render_block(Chain *chain, const Wav *in, Wav *out,
+                         unsigned int channel, unsigned int frame,
+                         unsigned int n, int32_t *work) {
+  unsigned int channels = in->channels;
+  const int16_t *src = in->samples + (size_t)frame * channels + channel;
+  if (channels == 1) {
+    q16_16_int16_to_fp_block(work, src, n);
+  } else {
+    for (unsigned int i = 0; i < n; i++) {
+      work[i] = q16_16_int16_to_fp(src[i * channels]);
+    }
+  }
+  Chain_process(chain, work, n);
+  if (out == NULL) {
+    return;
+  }
+  int16_t *dst = out->samples + (size_t)frame * channels + channel;
+  if (channels == 1) {
+    q16_16_fp_to_int16_block(dst, work, n);
+    return;
+  }
+  for (unsigned int i = 0; i < n; i++) {
+    dst[i * channels] = q16_16_fp_to_int16(work[i]);
+  }
+}
+
+// frames [start, end) of every channel, preceded by preroll frames that only
+// warm up the chains. start and preroll are multiples of the block size, so
+// blocks fall where they would in a serial render.
+typedef struct RenderJob {
+  const Wav *in;
+  Wav *out;
+  int nr_specs;
+  char **specs;
+  unsigned int block_size;
+  unsigned int start, end;
+  unsigned int preroll;
+  int result;
+  pthread_t thread;
+} RenderJob;
+
+static void *Render_job(void *arg) {
+  RenderJob *job = (RenderJob *)arg;
+  job->result = -1;
+  int32_t *work = (int32_t *)malloc(job->block_size * sizeof(int32_t));
+  if (work == NULL) {
+    return NULL;
+  }
+  for (unsigned int c = 0; c < job->in->channels; c++) {
+    Chain chain;
+    Chain_init(&chain);
+    if (Chain_parse(&chain, job->nr_specs, job->specs) != 0) {
+      Chain_free(&chain);
+      free(work);
+      return NULL;
+    }
+    unsigned int frame = job->start - job->preroll;
+    // LFOs and parameter glides are where they would be at this frame
+    Chain_advance(&chain, frame);
+    while (frame < job->end) {
+      unsigned int n = job->end - frame;
+      if (n > job->block_size) {
+        n = job->block_size;
+      }
+      Render_block(&chain, job->in, frame < job->start ? NULL : job->out, c,
+                   frame, n, work);
+      frame += n;
+    }
+    Chain_free(&chain);
+  }
+  free(work);
+  job->result = 0;
+  return NULL;
+}
+
+// samples the chain built from these specs keeps ringing, -1 on bad specs
+static int Render_tail(int nr_specs, char **specs, uint32_t *tail) {
+  Chain chain;
+  Chain_init(&chain);
+  int result = Chain_parse(&chain, nr_specs, specs);
+  if (result == 0) {
+    *tail = Chain_tail(&chain);
+  }
+  Chain_free(&chain);
+  return result;
+}
+
+/**
+ * Render a wav file through a chain into a new wav file of the same
+ * length, rate and channel count.
+ * @param nr_threads Threads to split the file over, 1 renders serially.
+ * @return 0 on success, -1 on error.
+ */
+int Render_wav(const char *in_path, const char *out_path, int nr_specs,
+               char **specs, unsigned int block_size,
+               unsigned int nr_threads) {
+  WavMap in, out;
+  if (Wav_map(in_path, &in) != 0) {
+    fprintf(stderr, "render: can't map '%s' as a 16-bit PCM wav file\n",
+            in_path);
+    return -1;
+  }
+  uint32_t tail;
+  if (Render_tail(nr_specs, specs, &tail) != 0) {
+    Wav_unmap(&in);
+    return -1;
+  }
+  if (Wav_map_create(out_path, in.wav.sample_rate, in.wav.channels,
+                     in.wav.nr_frames, &out) != 0) {
+    fprintf(stderr, "render: can't create '%s'\n", out_path);
+    Wav_unmap(&in);
+    return -1;
+  }
+
+  // chunks and pre-rolls are whole blocks
+  unsigned int nr_frames = in.wav.nr_frames;
+  unsigned int nr_blocks = (nr_frames + block_size - 1) / block_size;
+  if (nr_threads > nr_blocks) {
+    nr_threads = nr_blocks;
+  }
+  if (nr_threads < 1) {
+    nr_threads = 1;
+  }
+  // rounding the chunks up to whole blocks can leave the last threads with
+  // nothing to do, those are not started
+  uint64_t chunk_blocks = (nr_blocks + nr_threads - 1) / nr_threads;
+  if (chunk_blocks > 0) {
+    nr_threads = (unsigned int)((nr_blocks + chunk_blocks - 1) / chunk_blocks);
+  }
+  uint64_t chunk = chunk_blocks * block_size;
+  uint64_t preroll = ((uint64_t)tail + block_size - 1) / block_size *
+                     block_size;
+  if (nr_threads > 1 && (tail == EFFECT_TAIL_UNBOUNDED || preroll >= chunk)) {
+    fprintf(stderr, "render: the chain rings too long to split, rendering "
+                    "serially\n");
+    nr_threads = 1;
+    chunk = nr_frames;
+  }
+
+  RenderJob *jobs = (RenderJob *)calloc(nr_threads, sizeof(RenderJob));
+  int result = -1;
+  if (jobs == NULL) {
+    goto done;
+  }
+  for (unsigned int t = 0; t < nr_threads; t++) {
+    RenderJob *job = &jobs[t];
+    job->in = &in.wav;
+    job->out = &out.wav;
+    job->nr_specs = nr_specs;
+    job->specs = specs;
+    job->block_size = block_size;
+    uint64_t start = t * chunk;
+    uint64_t end = (t + 1) * chunk;
+    job->start = start < nr_frames ? (unsigned int)start : nr_frames;
+    job->end = t + 1 == nr_threads || end > nr_frames ? nr_frames
+                                                      : (unsigned int)end;
+    job->preroll = job->start < preroll ? job->start : (unsigned int)preroll;
+  }
+  // the first chunk runs here, a thread that can't start runs here as well
+  for (unsigned int t = 1; t < nr_threads; t++) {
+    if (pthread_create(&jobs[t].thread, NULL, Render_job, &jobs[t]) != 0) {
+      jobs[t].thread = pthread_self();
+    }
+  }
+  Render_job(&jobs[0]);
+  result = jobs[0].result;
+  for (unsigned int t = 1; t < nr_threads; t++) {
+    if (pthread_equal(jobs[t].thread, pthread_self())) {
+      Render_job(&jobs[t]);
+    } else {
+      pthread_join(jobs[t].thread, NULL);
+    }
+    if (jobs[t].result != 0) {
+      result = -1;
+    }
+  }
+
+done:
+  free(jobs);
+  Wav_unmap(&out);
+  Wav_unmap(&in);
+  return result;
+}
+
+#endif
@@ -1,76 +1,105 @@
 #ifndef REVERB_LIB
 #define REVERB_LIB 1
 
+#include "effect.h"
 #include "fixedpoint.h"
 #include "ringbuffer.h"
 
+#define REVERB_NUMTAPS 6
+
+// all taps read from one delay line sized to the longest of them
+const unsigned int Reverb_taps[REVERB_NUMTAPS] = {1229, 1559,  1907,
+                                                  4057, 33123, 19993};
+#define REVERB_LENGTH 33123
+
 typedef struct Reverb {
-  Ringbuffer *fb0;
-  Ringbuffer *fb1;
-  Ringbuffer *fb2;
-  Ringbuffer *fb3;
-  Ringbuffer *fb4;
-  Ringbuffer *fb5;
+  Ringbuffer *fb;
 } Reverb;
 
-Reverb *Reverb_malloc() {
-  Reverb *reverb = (Reverb *)malloc(sizeof(Reverb));
-  if (reverb == NULL) {
+Reverb *Reverb_alloc(Arena *arena) {
+  Reverb *reverb = (Reverb *)Arena_alloc(arena, sizeof(Reverb));
+  Ringbuffer *fb = Ringbuffer_alloc(arena, REVERB_LENGTH);
+  if (reverb == NULL || fb == NULL) {
     return NULL;
   }
-  reverb->fb0 = Ringbuffer_malloc(1229);
-  reverb->fb1 = Ringbuffer_malloc(1559);
-  reverb->fb2 = Ringbuffer_malloc(1907);
-  reverb->fb3 = Ringbuffer_malloc(4057);
-  reverb->fb4 = Ringbuffer_malloc(33123);
-  reverb->fb5 = Ringbuffer_malloc(19993);
-
-  // Check if any Ringbuffer creation failed
-  if (!reverb->fb0 || !reverb->fb1 || !reverb->fb2 || !reverb->fb3 ||
-      !reverb->fb4 || !reverb->fb5) {
-    // Free any successfully allocated buffers
-    Ringbuffer_free(reverb->fb0);
-    Ringbuffer_free(reverb->fb1);
-    Ringbuffer_free(reverb->fb2);
-    Ringbuffer_free(reverb->fb3);
-    Ringbuffer_free(reverb->fb4);
-    Ringbuffer_free(reverb->fb5);
-    free(reverb);
+  reverb->fb = fb;
+  return reverb;
+}
+
+Reverb *Reverb_malloc() {
+  Arena arena;
+  Arena_sizing(&arena);
+  Reverb_alloc(&arena);
+  if (Arena_malloc(&arena, arena.used) != 0) {
     return NULL;
   }
-
-  return reverb;
+  return Reverb_alloc(&arena);
 }
 
+// samples per pass, must not exceed the shortest tap so that a pass never
+// reads what it writes
+#define REVERB_CHUNK 256
+
 void Reverb_process(Reverb *reverb, int32_t *buf, unsigned int nr_samples) {
-  for (int i = 0; i < nr_samples; i++) {
-    int32_t x = q16_16_multiply(Q16_16_0_125, buf[i]);
-    x += q16_16_multiply(Q16_16_0_125, Ringbuffer_get(reverb->fb0));
-    x += q16_16_multiply(Q16_16_0_125, Ringbuffer_get(reverb->fb1));
-    x += q16_16_multiply(Q16_16_0_125, Ringbuffer_get(reverb->fb2));
-    x += q16_16_multiply(Q16_16_0_125, Ringbuffer_get(reverb->fb3));
-    x += q16_16_multiply(Q16_16_0_125, Ringbuffer_get(reverb->fb4));
-    x += q16_16_multiply(Q16_16_0_125, Ringbuffer_get(reverb->fb5));
-    Ringbuffer_add(reverb->fb0, x);
-    Ringbuffer_add(reverb->fb1, x);
-    Ringbuffer_add(reverb->fb2, x);
-    Ringbuffer_add(reverb->fb3, x);
-    Ringbuffer_add(reverb->fb4, x);
-    Ringbuffer_add(reverb->fb5, x);
-    buf[i] = q16_16_multiply(Q16_16_8, x);
+  int32_t x[REVERB_CHUNK];
+  for (unsigned int i = 0; i < nr_samples; i += REVERB_CHUNK) {
+    unsigned int n = nr_samples - i;
+    if (n > REVERB_CHUNK) {
+      n = REVERB_CHUNK;
+    }
+    memset(x, 0, n * sizeof(int32_t));
+    q16_16_mac_block(x, buf + i, Q16_16_0_125, n);
+    for (int t = 0; t < REVERB_NUMTAPS; t++) {
+      // adds 1/8 of the next n samples of the tap
+      Ringbuffer_tap_mac(reverb->fb, Reverb_taps[t], x, Q16_16_0_125,
+                         Q16_16_Q_BITS, n);
+    }
+    Ringbuffer_write(reverb->fb, x, n);
+    memcpy(buf + i, x, n * sizeof(int32_t));
+    // the sum is at most 7/8, only the gain of 8 can overflow
+    q16_16_shift_left_block_sat(buf + i, 3, n);
   }
 }
 
+void Reverb_reset(Reverb *reverb) { Ringbuffer_clear(reverb->fb); }
+
+// the reverb has no tunable parameters
+int Reverb_set_param(Reverb *reverb, const char *param, float value) {
+  return -1;
+}
+
+// six taps of 1/8 each feed back, at worst 3/4 of the input comes around
+// per pass of the longest tap, the output gain of 8 needs 3 more bits
+uint32_t Reverb_tail(Reverb *reverb) {
+  return Effect_feedback_tail(REVERB_LENGTH, Q16_16_0_5 + Q16_16_0_125 * 2,
+                              Q16_16_Q_BITS, EFFECT_TAIL_BITS + 3);
+}
+
 void Reverb_free(Reverb *reverb) {
-  if (reverb != NULL) {
-    Ringbuffer_free(reverb->fb0);
-    Ringbuffer_free(reverb->fb1);
-    Ringbuffer_free(reverb->fb2);
-    Ringbuffer_free(reverb->fb3);
-    Ringbuffer_free(reverb->fb4);
-    Ringbuffer_free(reverb->fb5);
-    free(reverb);
-  }
+  free(reverb);
+}
+
+static void Reverb_effect_process(void *self, int32_t *buf,
+                                  unsigned int nr_samples) {
+  Reverb_process((Reverb *)self, buf, nr_samples);
+}
+
+static int Reverb_effect_set_param(void *self, const char *param,
+                                   float value) {
+  return Reverb_set_param((Reverb *)self, param, value);
+}
+
+static void Reverb_effect_reset(void *self) { Reverb_reset((Reverb *)self); }
+
+static uint32_t Reverb_effect_tail(void *self) {
+  return Reverb_tail((Reverb *)self);
 }
 
+// the reverb has no time based state
+static void Reverb_effect_advance(void *self, uint32_t n) {}
+
+const EffectOps Reverb_ops = {"reverb", Reverb_effect_process,
+                              Reverb_effect_set_param, Reverb_effect_reset,
+                              Reverb_effect_tail, Reverb_effect_advance};
+
 #endif
\ No newline at end of file
@@ -1,31 +1,126 @@
 #ifndef RINGBUFFER_LIB_H
 #define RINGBUFFER_LIB_H
 
+#include "arena.h"
+#include "fixedpoint.h"
+
+// Delay line storage. Built with -DFPFX_COMPACT_DELAY delay lines keep only
+// the int16 part of each sample, rounded to nearest, which halves their
+// memory; samples are widened back to Q16.16 as they are read. Otherwise
+// they keep the full Q16.16 sample.
+#ifdef FPFX_COMPACT_DELAY
+typedef int16_t DelaySample;
+
+static inline int32_t DelaySample_load(DelaySample x) {
+  return q16_16_int16_to_fp(x);
+}
+
+static inline DelaySample DelaySample_store(int32_t x) {
+  return q16_16_round_int16(x);
+}
+
+static inline void DelaySample_load_block(int32_t* dst,
+                                          const DelaySample* src,
+                                          unsigned int n) {
+  q16_16_int16_to_fp_block(dst, src, n);
+}
+
+static inline void DelaySample_store_block(DelaySample* dst,
+                                           const int32_t* src,
+                                           unsigned int n) {
+  q16_16_round_int16_block(dst, src, n);
+}
+#else
+typedef int32_t DelaySample;
+
+static inline int32_t DelaySample_load(DelaySample x) { return x; }
+
+static inline DelaySample DelaySample_store(int32_t x) { return x; }
+
+static inline void DelaySample_load_block(int32_t* dst,
+                                          const DelaySample* src,
+                                          unsigned int n) {
+  memcpy(dst, src, n * sizeof(int32_t));
+}
+
+static inline void DelaySample_store_block(DelaySample* dst,
+                                           const int32_t* src,
+                                           unsigned int n) {
+  memcpy(dst, src, n * sizeof(int32_t));
+}
+#endif
+
+// samples widened per pass when a compact line is read a block at a time
+#define RINGBUFFER_CHUNK 256
+
 typedef struct Ringbuffer {
   unsigned int nr_samples;
-  int32_t* samples;
+  DelaySample* samples;
   unsigned int pos;
+  // nr_samples - 1 for power-of-two buffers, which wrap with a mask
+  unsigned int mask;
 } Ringbuffer;
 
+// Up to two contiguous runs covering n consecutive samples of the buffer,
+// the second run is empty unless the n samples wrap around the end.
+typedef struct RingbufferSpan {
+  DelaySample* data[2];
+  unsigned int nr_samples[2];
+} RingbufferSpan;
+
+static inline unsigned int Ringbuffer_pow2(unsigned int min_samples) {
+  unsigned int nr_samples = 1;
+  while (nr_samples < min_samples) {
+    nr_samples <<= 1;
+  }
+  return nr_samples;
+}
+
 Ringbuffer* Ringbuffer_malloc(unsigned int nr_samples) {
   Ringbuffer* fb = (Ringbuffer*)malloc(sizeof(Ringbuffer));
   if (fb == NULL) {
     return NULL;
   }
   fb->nr_samples = nr_samples;
-  fb->samples = (int32_t*)malloc(nr_samples * sizeof(int32_t));
+  fb->samples = (DelaySample*)malloc(nr_samples * sizeof(DelaySample));
   if (fb->samples == NULL) {
     free(fb);
     return NULL;
   }
 
   // Initialize the allocated memory to zero
-  memset(fb->samples, 0, nr_samples * sizeof(int32_t));
+  memset(fb->samples, 0, nr_samples * sizeof(DelaySample));
 
   fb->pos = 0;
+  fb->mask = (nr_samples & (nr_samples - 1)) == 0 ? nr_samples - 1 : 0;
+  return fb;
+}
+
+// Allocates a buffer with the capacity rounded up to a power of two.
+Ringbuffer* Ringbuffer_malloc_pow2(unsigned int min_samples) {
+  return Ringbuffer_malloc(Ringbuffer_pow2(min_samples));
+}
+
+// Places the buffer and its samples in the arena, it is released with the
+// arena and must not be passed to Ringbuffer_free.
+Ringbuffer* Ringbuffer_alloc(Arena* arena, unsigned int nr_samples) {
+  Ringbuffer* fb = (Ringbuffer*)Arena_alloc(arena, sizeof(Ringbuffer));
+  DelaySample* samples =
+      (DelaySample*)Arena_alloc(arena, nr_samples * sizeof(DelaySample));
+  if (fb == NULL || samples == NULL) {
+    return NULL;
+  }
+  fb->nr_samples = nr_samples;
+  fb->samples = samples;
+  fb->pos = 0;
+  fb->mask = (nr_samples & (nr_samples - 1)) == 0 ? nr_samples - 1 : 0;
   return fb;
 }
 
+Ringbuffer* Ringbuffer_alloc_pow2(Arena* arena, unsigned int min_samples) {
+  return Ringbuffer_alloc(arena, Ringbuffer_pow2(min_samples));
+}
+
 void Ringbuffer_free(Ringbuffer* fb) {
   if (fb != NULL) {
     free(fb->samples);
@@ -33,16 +128,204 @@ void Ringbuffer_free(Ringbuffer* fb) {
   }
 }
 
-int32_t Ringbuffer_get(const Ringbuffer* fb) { return fb->samples[fb->pos]; }
+void Ringbuffer_clear(Ringbuffer* fb) {
+  memset(fb->samples, 0, fb->nr_samples * sizeof(DelaySample));
+  fb->pos = 0;
+}
+
+int32_t Ringbuffer_get(const Ringbuffer* fb) {
+  return DelaySample_load(fb->samples[fb->pos]);
+}
 
 void Ringbuffer_add(Ringbuffer* fb, int32_t sample) {
-  while (fb->pos > fb->nr_samples) {
-    fb->pos -= fb->nr_samples;
-  }
-  fb->samples[fb->pos] = sample;
+  fb->samples[fb->pos] = DelaySample_store(sample);
 
   /* If we reach the end of the buffer, wrap around */
-  if (++fb->pos == fb->nr_samples) fb->pos = 0;
+  if (fb->mask) {
+    fb->pos = (fb->pos + 1) & fb->mask;
+  } else if (++fb->pos == fb->nr_samples) {
+    fb->pos = 0;
+  }
+}
+
+/**
+ * Get the spans of the next n samples, n must not exceed the capacity.
+ * Reading them gives what n calls to Ringbuffer_get would return, writing
+ * them stores what n calls to Ringbuffer_add would store.
+ */
+void Ringbuffer_spans(const Ringbuffer* fb, unsigned int n,
+                      RingbufferSpan* span) {
+  unsigned int first = fb->nr_samples - fb->pos;
+  if (first > n) {
+    first = n;
+  }
+  span->data[0] = fb->samples + fb->pos;
+  span->nr_samples[0] = first;
+  span->data[1] = fb->samples;
+  span->nr_samples[1] = n - first;
+}
+
+void Ringbuffer_advance(Ringbuffer* fb, unsigned int n) {
+  if (fb->mask) {
+    fb->pos = (fb->pos + n) & fb->mask;
+  } else {
+    fb->pos += n;
+    if (fb->pos >= fb->nr_samples) {
+      fb->pos -= fb->nr_samples;
+    }
+  }
+}
+
+// copies the next n samples out without advancing
+void Ringbuffer_read(const Ringbuffer* fb, int32_t* dst, unsigned int n) {
+  RingbufferSpan span;
+  Ringbuffer_spans(fb, n, &span);
+  DelaySample_load_block(dst, span.data[0], span.nr_samples[0]);
+  DelaySample_load_block(dst + span.nr_samples[0], span.data[1],
+                         span.nr_samples[1]);
+}
+
+// stores n samples and advances past them
+void Ringbuffer_write(Ringbuffer* fb, const int32_t* src, unsigned int n) {
+  RingbufferSpan span;
+  Ringbuffer_spans(fb, n, &span);
+  DelaySample_store_block(span.data[0], src, span.nr_samples[0]);
+  DelaySample_store_block(span.data[1], src + span.nr_samples[0],
+                          span.nr_samples[1]);
+  Ringbuffer_advance(fb, n);
+}
+
+/* Taps: reads at an offset behind the write position, a delay of
+   nr_samples gives the same sample as Ringbuffer_get. */
+
+static inline unsigned int Ringbuffer_tap_index(const Ringbuffer* fb,
+                                                unsigned int delay) {
+  if (fb->mask) {
+    return (fb->pos - delay) & fb->mask;
+  }
+  return fb->pos >= delay ? fb->pos - delay
+                           : fb->pos + fb->nr_samples - delay;
+}
+
+// the sample added `delay` calls to Ringbuffer_add ago, 1 <= delay <= size
+static inline int32_t Ringbuffer_tap(const Ringbuffer* fb,
+                                     unsigned int delay) {
+  return DelaySample_load(fb->samples[Ringbuffer_tap_index(fb, delay)]);
+}
+
+// the interpolation every fractional tap uses, frac of the way from a to b
+static inline int32_t Ringbuffer_lerp(int32_t a, int32_t b, int32_t frac) {
+  return a + q16_16_multiply(b - a, frac);
+}
+
+// fractional Q16.16 delay, linearly interpolated, 1 <= delay < size
+static inline int32_t Ringbuffer_tap_frac(const Ringbuffer* fb,
+                                          int32_t delay) {
+  unsigned int d = delay >> Q16_16_Q_BITS;
+  int32_t frac = delay & (Q16_16_1 - 1);
+  int32_t a = Ringbuffer_tap(fb, d);
+  int32_t b = Ringbuffer_tap(fb, d + 1);
+  return Ringbuffer_lerp(a, b, frac);
+}
+
+/**
+ * Spans of the next n samples of a tap. Only valid for n <= delay, longer
+ * runs would reach samples that have not been written yet.
+ */
+void Ringbuffer_tap_spans(const Ringbuffer* fb, unsigned int delay,
+                          unsigned int n, RingbufferSpan* span) {
+  unsigned int start = Ringbuffer_tap_index(fb, delay);
+  unsigned int first = fb->nr_samples - start;
+  if (first > n) {
+    first = n;
+  }
+  span->data[0] = fb->samples + start;
+  span->nr_samples[0] = first;
+  span->data[1] = fb->samples;
+  span->nr_samples[1] = n - first;
+}
+
+// adds a run of stored samples scaled by a gain into dst, compact samples
+// are widened a chunk at a time
+static inline void Ringbuffer_mac_run(int32_t* dst, const DelaySample* src,
+                                      int32_t gain, unsigned int bits,
+                                      unsigned int n, int saturate) {
+#ifdef FPFX_COMPACT_DELAY
+  int32_t wide[RINGBUFFER_CHUNK];
+  for (unsigned int i = 0; i < n; i += RINGBUFFER_CHUNK) {
+    unsigned int m = n - i < RINGBUFFER_CHUNK ? n - i : RINGBUFFER_CHUNK;
+    DelaySample_load_block(wide, src + i, m);
+    if (saturate) {
+      q_mac_block_sat(dst + i, wide, gain, bits, m);
+    } else {
+      q_mac_block(dst + i, wide, gain, bits, m);
+    }
+  }
+#else
+  if (saturate) {
+    q_mac_block_sat(dst, src, gain, bits, n);
+  } else {
+    q_mac_block(dst, src, gain, bits, n);
+  }
+#endif
+}
+
+/**
+ * Adds the next n samples of a tap, scaled by a gain with bits fractional
+ * bits, into dst. Only valid for n <= delay, like Ringbuffer_tap_spans.
+ */
+void Ringbuffer_tap_mac(const Ringbuffer* fb, unsigned int delay,
+                        int32_t* dst, int32_t gain, unsigned int bits,
+                        unsigned int n) {
+  RingbufferSpan span;
+  Ringbuffer_tap_spans(fb, delay, n, &span);
+  Ringbuffer_mac_run(dst, span.data[0], gain, bits, span.nr_samples[0], 0);
+  Ringbuffer_mac_run(dst + span.nr_samples[0], span.data[1], gain, bits,
+                     span.nr_samples[1], 0);
+}
+
+/**
+ * Reads the next n samples of a tap at a fractional Q16.16 delay into dst,
+ * what Ringbuffer_tap_frac would give sample by sample. Only valid for
+ * n <= delay, like Ringbuffer_tap_spans, and 1 <= delay < size.
+ */
+void Ringbuffer_tap_frac_block(const Ringbuffer* fb, int32_t delay,
+                               int32_t* dst, unsigned int n) {
+  unsigned int d = delay >> Q16_16_Q_BITS;
+  int32_t frac = delay & (Q16_16_1 - 1);
+  unsigned int a = Ringbuffer_tap_index(fb, d);
+  unsigned int b = Ringbuffer_tap_index(fb, d + 1);
+  const DelaySample* samples = fb->samples;
+  if (fb->mask) {
+    unsigned int mask = fb->mask;
+    for (unsigned int k = 0; k < n; k++) {
+      dst[k] = Ringbuffer_lerp(DelaySample_load(samples[(a + k) & mask]),
+                               DelaySample_load(samples[(b + k) & mask]),
+                               frac);
+    }
+    return;
+  }
+  for (unsigned int k = 0; k < n; k++) {
+    dst[k] = Ringbuffer_lerp(DelaySample_load(samples[a]),
+                             DelaySample_load(samples[b]), frac);
+    if (++a == fb->nr_samples) {
+      a = 0;
+    }
+    if (++b == fb->nr_samples) {
+      b = 0;
+    }
+  }
+}
+
+// Ringbuffer_tap_mac, saturating the products and sums
+void Ringbuffer_tap_mac_sat(const Ringbuffer* fb, unsigned int delay,
+                            int32_t* dst, int32_t gain, unsigned int bits,
+                            unsigned int n) {
+  RingbufferSpan span;
+  Ringbuffer_tap_spans(fb, delay, n, &span);
+  Ringbuffer_mac_run(dst, span.data[0], gain, bits, span.nr_samples[0], 1);
+  Ringbuffer_mac_run(dst + span.nr_samples[0], span.data[1], gain, bits,
+                     span.nr_samples[1], 1);
 }
 
-#endif
\ No newline at end of file
+#endif
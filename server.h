@@ -0,0 +1,451 @@
+#ifndef SERVER_LIB
+#define SERVER_LIB 1
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "chain.h"
+#include "fixedpoint.h"
+#include "futex.h"
+
+// Hosts many independent streams in one process. Every stream has its own
+// chain and a pair of single-producer/single-consumer rings in a shared
+// memory segment under /dev/shm: clients write int16 samples into the input
+// ring and read the processed samples back from the output ring. A pool of
+// workers owns the streams round-robin, stream s belongs to worker
+// s % nr_workers, so every chain is only ever touched by one thread.
+//
+// Sleeping is done on futexes in the segment. A client rings its worker's
+// doorbell after writing input, the worker rings the stream's bell after
+// producing output; either side only makes the wake syscall when the other
+// one is actually waiting.
+
+#define SERVER_MAGIC 0x66706678  // "fpfx"
+#define SERVER_MAX_STREAMS 1024
+#define SERVER_MAX_WORKERS 64
+// int16 samples per ring, a power of two
+#define SERVER_RING_SIZE 16384
+// samples per chain call, smaller final blocks only when a stream drains
+#define SERVER_BLOCK 256
+#define SERVER_MAX_NAME 64
+
+// stream states
+#define SERVER_FREE 0
+#define SERVER_ACTIVE 1
+#define SERVER_DRAINING 2  // the client has written its last input
+
+// head and tail count samples since the segment was created and wrap
+// naturally, so head - tail is always the fill level
+typedef struct ServerRing {
+  _Atomic uint32_t head __attribute__((aligned(64)));  // producer only
+  _Atomic uint32_t tail __attribute__((aligned(64)));  // consumer only
+  int16_t samples[SERVER_RING_SIZE] __attribute__((aligned(64)));
+} ServerRing;
+
+typedef struct ServerStream {
+  _Atomic uint32_t state;
+  _Atomic uint32_t session;  // bumped by every client that claims the stream
+  _Atomic uint32_t bell;     // rung by the worker after each block
+  _Atomic uint32_t client_waiting;
+  ServerRing in;
+  ServerRing out;
+} ServerStream;
+
+typedef struct ServerBell {
+  _Atomic uint32_t doorbell __attribute__((aligned(64)));
+  _Atomic uint32_t waiting;
+} ServerBell;
+
+typedef struct ServerShm {
+  uint32_t magic;
+  uint32_t nr_streams;
+  uint32_t nr_workers;
+  ServerBell workers[SERVER_MAX_WORKERS];
+  ServerStream streams[];
+} ServerShm;
+
+static inline size_t Server_shm_size(unsigned int nr_streams) {
+  return sizeof(ServerShm) + nr_streams * sizeof(ServerStream);
+}
+
+static void Server_shm_name(char *out, const char *name) {
+  snprintf(out, SERVER_MAX_NAME + 8, "/fpfx-%s", name);
+}
+
+/* Ring transfers, both return the number of samples moved. */
+
+static unsigned int ServerRing_push(ServerRing *ring, const int16_t *src,
+                                    unsigned int n) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t space = SERVER_RING_SIZE - (head - atomic_load(&ring->tail));
+  if (n > space) {
+    n = space;
+  }
+  unsigned int pos = head & (SERVER_RING_SIZE - 1);
+  unsigned int first = SERVER_RING_SIZE - pos;
+  if (first > n) {
+    first = n;
+  }
+  memcpy(ring->samples + pos, src, first * sizeof(int16_t));
+  memcpy(ring->samples, src + first, (n - first) * sizeof(int16_t));
+  atomic_store(&ring->head, head + n);
+  return n;
+}
+
+static unsigned int ServerRing_pop(ServerRing *ring, int16_t *dst,
+                                   unsigned int n) {
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t avail = atomic_load(&ring->head) - tail;
+  if (n > avail) {
+    n = avail;
+  }
+  unsigned int pos = tail & (SERVER_RING_SIZE - 1);
+  unsigned int first = SERVER_RING_SIZE - pos;
+  if (first > n) {
+    first = n;
+  }
+  memcpy(dst, ring->samples + pos, first * sizeof(int16_t));
+  memcpy(dst + first, ring->samples, (n - first) * sizeof(int16_t));
+  atomic_store(&ring->tail, tail + n);
+  return n;
+}
+
+/* Server side */
+
+typedef struct Server Server;
+
+typedef struct ServerWorker {
+  Server *server;
+  unsigned int index;
+  pthread_t thread;
+} ServerWorker;
+
+struct Server {
+  char shm_name[SERVER_MAX_NAME + 8];
+  ServerShm *shm;
+  size_t shm_size;
+  unsigned int nr_streams;
+  unsigned int nr_workers;
+  Chain *chains;    // one per stream, all in chain_mem
+  void *chain_mem;  // a single arena block for every chain
+  uint32_t *sessions;  // session each chain was last built for
+  int nr_specs;        // the chain, rebuilt for every new session
+  char **specs;
+  ServerWorker workers[SERVER_MAX_WORKERS];
+  _Atomic int running;
+};
+
+/**
+ * Create the shared memory segment and a chain per stream.
+ * @param name Segment name, clients connect with the same name.
+ * @param specs Kept to rebuild the chains, must outlive the server.
+ * @return 0 on success, -1 on error.
+ */
+int Server_open(Server *server, const char *name, unsigned int nr_streams,
+                unsigned int nr_workers, int nr_specs, char **specs) {
+  memset(server, 0, sizeof(Server));
+  if (strlen(name) >= SERVER_MAX_NAME || nr_streams == 0 ||
+      nr_streams > SERVER_MAX_STREAMS || nr_workers == 0) {
+    fprintf(stderr, "server: bad name or stream count\n");
+    return -1;
+  }
+  if (nr_workers > SERVER_MAX_WORKERS) {
+    nr_workers = SERVER_MAX_WORKERS;
+  }
+  if (nr_workers > nr_streams) {
+    nr_workers = nr_streams;
+  }
+  server->nr_streams = nr_streams;
+  server->nr_workers = nr_workers;
+  server->nr_specs = nr_specs;
+  server->specs = specs;
+
+  // every chain is carved from one block, sized once
+  size_t chain_size;
+  if (Chain_size(nr_specs, specs, &chain_size) != 0) {
+    return -1;
+  }
+  chain_size = Arena_round(chain_size);
+  server->chains = (Chain *)calloc(nr_streams, sizeof(Chain));
+  server->sessions = (uint32_t *)calloc(nr_streams, sizeof(uint32_t));
+  server->chain_mem = aligned_alloc(
+      ARENA_ALIGN, chain_size > 0 ? nr_streams * chain_size : ARENA_ALIGN);
+  if (server->chains == NULL || server->sessions == NULL ||
+      server->chain_mem == NULL) {
+    fprintf(stderr, "server: out of memory\n");
+    return -1;
+  }
+  for (unsigned int s = 0; s < nr_streams; s++) {
+    Chain_init(&server->chains[s]);
+    if (Chain_parse_in(&server->chains[s],
+                       (uint8_t *)server->chain_mem + s * chain_size,
+                       chain_size, nr_specs, specs) != 0) {
+      return -1;
+    }
+  }
+
+  Server_shm_name(server->shm_name, name);
+  int fd = shm_open(server->shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd == -1) {
+    perror("server: shm_open");
+    return -1;
+  }
+  server->shm_size = Server_shm_size(nr_streams);
+  if (ftruncate(fd, server->shm_size) != 0) {
+    perror("server: ftruncate");
+    close(fd);
+    shm_unlink(server->shm_name);
+    return -1;
+  }
+  void *shm = mmap(NULL, server->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED) {
+    perror("server: mmap");
+    shm_unlink(server->shm_name);
+    return -1;
+  }
+  // ftruncate zero-fills: every stream starts SERVER_FREE with empty rings
+  server->shm = (ServerShm *)shm;
+  server->shm->nr_streams = nr_streams;
+  server->shm->nr_workers = nr_workers;
+  atomic_thread_fence(memory_order_seq_cst);
+  server->shm->magic = SERVER_MAGIC;
+  return 0;
+}
+
+/**
+ * Process at most one block of a stream.
+ * @return 1 if a block was processed.
+ */
+static int Server_service(Server *server, unsigned int s) {
+  ServerStream *stream = &server->shm->streams[s];
+  uint32_t state = atomic_load(&stream->state);
+  if (state == SERVER_FREE) {
+    return 0;
+  }
+  uint32_t avail = atomic_load(&stream->in.head) - stream->in.tail;
+  uint32_t space =
+      SERVER_RING_SIZE - (stream->out.head - atomic_load(&stream->out.tail));
+  unsigned int n = SERVER_BLOCK;
+  if (n > avail) {
+    n = avail;
+  }
+  if (n > space) {
+    n = space;
+  }
+  // partial blocks only once the client has written everything
+  if (n == 0 || (n < SERVER_BLOCK && state != SERVER_DRAINING)) {
+    return 0;
+  }
+
+  // read after the ring, a new client bumps the session before writing.
+  // Every client, the first one included, gets a chain as main builds it.
+  uint32_t session = atomic_load(&stream->session);
+  if (session != server->sessions[s]) {
+    Chain_rebuild(&server->chains[s], server->nr_specs, server->specs);
+    server->sessions[s] = session;
+  }
+
+  int16_t samples[SERVER_BLOCK];
+  int32_t buf[SERVER_BLOCK];
+  ServerRing_pop(&stream->in, samples, n);
+  q16_16_int16_to_fp_block(buf, samples, n);
+  Chain_process(&server->chains[s], buf, n);
+  q16_16_fp_to_int16_block(samples, buf, n);
+  ServerRing_push(&stream->out, samples, n);
+  Futex_ring(&stream->bell, &stream->client_waiting);
+  return 1;
+}
+
+static void *Server_worker(void *arg) {
+  ServerWorker *worker = (ServerWorker *)arg;
+  Server *server = worker->server;
+  ServerBell *bell = &server->shm->workers[worker->index];
+
+  while (atomic_load(&server->running)) {
+    uint32_t seq = atomic_load(&bell->doorbell);
+    int busy = 0;
+    for (unsigned int s = worker->index; s < server->nr_streams;
+         s += server->nr_workers) {
+      busy |= Server_service(server, s);
+    }
+    if (busy) {
+      continue;
+    }
+    // a client that rings after the scan either changes the doorbell
+    // before the wait or sees waiting set and wakes us
+    atomic_store(&bell->waiting, 1);
+    if (atomic_load(&bell->doorbell) == seq && atomic_load(&server->running)) {
+      Futex_wait(&bell->doorbell, seq);
+    }
+    atomic_store(&bell->waiting, 0);
+  }
+  return NULL;
+}
+
+int Server_start(Server *server) {
+  atomic_store(&server->running, 1);
+  for (unsigned int w = 0; w < server->nr_workers; w++) {
+    server->workers[w].server = server;
+    server->workers[w].index = w;
+    if (pthread_create(&server->workers[w].thread, NULL, Server_worker,
+                       &server->workers[w]) != 0) {
+      fprintf(stderr, "server: could not start worker %u\n", w);
+      server->nr_workers = w;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void Server_stop(Server *server) {
+  atomic_store(&server->running, 0);
+  for (unsigned int w = 0; w < server->nr_workers; w++) {
+    ServerBell *bell = &server->shm->workers[w];
+    atomic_fetch_add(&bell->doorbell, 1);
+    Futex_wake(&bell->doorbell);
+  }
+  for (unsigned int w = 0; w < server->nr_workers; w++) {
+    pthread_join(server->workers[w].thread, NULL);
+  }
+}
+
+void Server_close(Server *server) {
+  if (server->shm != NULL) {
+    munmap(server->shm, server->shm_size);
+    shm_unlink(server->shm_name);
+    server->shm = NULL;
+  }
+  free(server->chain_mem);
+  free(server->chains);
+  free(server->sessions);
+  server->chain_mem = NULL;
+  server->chains = NULL;
+  server->sessions = NULL;
+}
+
+/* Client side */
+
+typedef struct ServerClient {
+  ServerShm *shm;
+  size_t shm_size;
+  ServerStream *stream;
+  ServerBell *worker;
+} ServerClient;
+
+/**
+ * Map a server's segment and claim a free stream.
+ * @return 0 on success, -1 if there is no such server or no free stream.
+ */
+int ServerClient_connect(ServerClient *client, const char *name) {
+  char shm_name[SERVER_MAX_NAME + 8];
+  if (strlen(name) >= SERVER_MAX_NAME) {
+    return -1;
+  }
+  Server_shm_name(shm_name, name);
+  int fd = shm_open(shm_name, O_RDWR, 0);
+  if (fd == -1) {
+    perror("client: shm_open");
+    return -1;
+  }
+  ServerShm header;
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      header.magic != SERVER_MAGIC) {
+    fprintf(stderr, "client: '%s' is not an fpfx server\n", name);
+    close(fd);
+    return -1;
+  }
+  client->shm_size = Server_shm_size(header.nr_streams);
+  void *shm = mmap(NULL, client->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED) {
+    perror("client: mmap");
+    return -1;
+  }
+  client->shm = (ServerShm *)shm;
+
+  for (unsigned int s = 0; s < client->shm->nr_streams; s++) {
+    ServerStream *stream = &client->shm->streams[s];
+    uint32_t expected = SERVER_FREE;
+    if (atomic_compare_exchange_strong(&stream->state, &expected,
+                                       SERVER_ACTIVE)) {
+      // the rings were left empty by the previous client
+      atomic_fetch_add(&stream->session, 1);
+      client->stream = stream;
+      client->worker = &client->shm->workers[s % client->shm->nr_workers];
+      return 0;
+    }
+  }
+  fprintf(stderr, "client: all %u streams are busy\n",
+          client->shm->nr_streams);
+  munmap(client->shm, client->shm_size);
+  return -1;
+}
+
+// queues up to n samples without blocking, returns how many were taken
+unsigned int ServerClient_write(ServerClient *client, const int16_t *src,
+                                unsigned int n) {
+  n = ServerRing_push(&client->stream->in, src, n);
+  if (n > 0) {
+    Futex_ring(&client->worker->doorbell, &client->worker->waiting);
+  }
+  return n;
+}
+
+// takes up to n processed samples without blocking
+unsigned int ServerClient_read(ServerClient *client, int16_t *dst,
+                               unsigned int n) {
+  n = ServerRing_pop(&client->stream->out, dst, n);
+  if (n > 0) {
+    // the worker may be waiting for room in the output ring
+    Futex_ring(&client->worker->doorbell, &client->worker->waiting);
+  }
+  return n;
+}
+
+// current bell value, pass it to ServerClient_wait
+uint32_t ServerClient_bell(ServerClient *client) {
+  return atomic_load(&client->stream->bell);
+}
+
+// sleeps until the worker has processed a block since the bell was read
+void ServerClient_wait(ServerClient *client, uint32_t bell) {
+  ServerStream *stream = client->stream;
+  atomic_store(&stream->client_waiting, 1);
+  if (atomic_load(&stream->bell) == bell) {
+    Futex_wait(&stream->bell, bell);
+  }
+  atomic_store(&stream->client_waiting, 0);
+}
+
+// marks the end of the input, the remainder is processed as a short block
+void ServerClient_drain(ServerClient *client) {
+  atomic_store(&client->stream->state, SERVER_DRAINING);
+  Futex_ring(&client->worker->doorbell, &client->worker->waiting);
+}
+
+// true once all written samples have been processed and read
+int ServerClient_done(ServerClient *client) {
+  return atomic_load(&client->stream->out.tail) ==
+         atomic_load(&client->stream->in.head);
+}
+
+// releases the stream, which must be done
+void ServerClient_close(ServerClient *client) {
+  atomic_store(&client->stream->state, SERVER_FREE);
+  munmap(client->shm, client->shm_size);
+  client->shm = NULL;
+  client->stream = NULL;
+}
+
+#endif
@@ -4,56 +4,124 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+// Linear parameter smoother for Q16.16 values. The value is kept with 16
+// extra fractional bits so long ramps land on the target without drift.
 typedef struct Slew {
-  float current;                 // Current value of the parameter
-  float target;                  // Target value to slew towards
-  float step;                    // Step size per sample
+  int64_t current;  // Q16.16 << 16
+  int64_t target;
+  int64_t step;                  // Step size per sample
   unsigned int remaining_steps;  // Remaining steps to reach the target
 } Slew;
 
 /**
- * Initialize a Slew instance.
+ * Convert a slew time to samples.
+ * @param ms Time in milliseconds.
+ * @param sample_rate Samples per second.
+ */
+static inline unsigned int Slew_ms_to_steps(float ms,
+                                            unsigned int sample_rate) {
+  if (ms <= 0) {
+    return 0;
+  }
+  return (unsigned int)(ms * sample_rate / 1000.0f + 0.5f);
+}
+
+/**
+ * Initialize a Slew instance, settled at a value.
  * @param slew Pointer to the Slew instance.
- * @param steps The number of samples over which to slew.
- * @param initial_value The initial value of the parameter.
+ * @param initial_value The initial Q16.16 value of the parameter.
  */
-void Slew_init(Slew *slew, unsigned int steps, float initial_value) {
-  slew->current = initial_value;
-  slew->target = initial_value;
-  slew->step = 0.0f;
+void Slew_init(Slew *slew, int32_t initial_value) {
+  slew->current = (int64_t)initial_value << 16;
+  slew->target = slew->current;
+  slew->step = 0;
   slew->remaining_steps = 0;
 }
 
 /**
  * Set a new target value for the Slew instance.
  * @param slew Pointer to the Slew instance.
- * @param target The new target value.
+ * @param target The new Q16.16 target value.
  * @param steps The number of samples over which to transition to the target.
  */
-void Slew_set_target(Slew *slew, float target, unsigned int steps) {
-  slew->target = target;
+void Slew_set_target(Slew *slew, int32_t target, unsigned int steps) {
+  slew->target = (int64_t)target << 16;
   slew->remaining_steps = steps;
   if (steps > 0) {
-    slew->step = (target - slew->current) / (float)steps;
+    slew->step = (slew->target - slew->current) / steps;
   } else {
-    slew->current = target;  // Instant transition if steps == 0
-    slew->step = 0.0f;
+    slew->current = slew->target;  // Instant transition if steps == 0
+    slew->step = 0;
   }
 }
 
+void Slew_set_target_ms(Slew *slew, int32_t target, float ms,
+                        unsigned int sample_rate) {
+  Slew_set_target(slew, target, Slew_ms_to_steps(ms, sample_rate));
+}
+
+static inline int Slew_settled(const Slew *slew) {
+  return slew->remaining_steps == 0;
+}
+
+// the Q16.16 value the last processed sample had
+static inline int32_t Slew_value(const Slew *slew) {
+  return (int32_t)(slew->current >> 16);
+}
+
 /**
  * Process a Slew instance for one sample.
  * @param slew Pointer to the Slew instance.
- * @return The current value after slewing.
+ * @return The current Q16.16 value after slewing.
  */
-float Slew_process(Slew *slew) {
+static inline int32_t Slew_process(Slew *slew) {
   if (slew->remaining_steps > 0) {
     slew->current += slew->step;
     slew->remaining_steps--;
   } else {
     slew->current = slew->target;
   }
-  return slew->current;
+  return Slew_value(slew);
+}
+
+// skips n samples, the same as n calls to Slew_process
+void Slew_advance(Slew *slew, unsigned int n) {
+  if (n > slew->remaining_steps) {
+    slew->current = slew->target;
+    slew->remaining_steps = 0;
+  } else {
+    slew->current += (int64_t)n * slew->step;
+    slew->remaining_steps -= n;
+  }
+}
+
+/**
+ * Advance a whole block, the same as n calls to Slew_process.
+ * @param out Receives the n values, left untouched when settled.
+ * @return 1 if the slew was settled, the value is then Slew_value for the
+ *         whole block, 0 if out holds a ramp.
+ */
+int Slew_process_block(Slew *slew, int32_t *out, unsigned int n) {
+  if (slew->remaining_steps == 0) {
+    slew->current = slew->target;
+    return 1;
+  }
+  unsigned int ramp = n < slew->remaining_steps ? n : slew->remaining_steps;
+  int64_t current = slew->current;
+  int64_t step = slew->step;
+  for (unsigned int i = 0; i < ramp; i++) {
+    out[i] = (int32_t)((current + (int64_t)(i + 1) * step) >> 16);
+  }
+  slew->current = current + (int64_t)ramp * step;
+  slew->remaining_steps -= ramp;
+  if (ramp < n) {
+    slew->current = slew->target;
+    int32_t target = Slew_value(slew);
+    for (unsigned int i = ramp; i < n; i++) {
+      out[i] = target;
+    }
+  }
+  return 0;
 }
 
 #endif
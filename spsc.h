@@ -0,0 +1,71 @@
+#ifndef SPSC_LIB
+#define SPSC_LIB 1
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "futex.h"
+
+// capacity of a queue in items, a power of two
+#define SPSC_CAPACITY 16
+
+// Lock-free single-producer/single-consumer queue of pointers. Push blocks
+// while the queue is full and pop while it is empty, sleeping on a futex;
+// the wake syscall is only made when the other side sleeps.
+typedef struct Spsc {
+  _Atomic uint32_t head __attribute__((aligned(64)));  // producer only
+  _Atomic uint32_t consumer_waiting;
+  _Atomic uint32_t tail __attribute__((aligned(64)));  // consumer only
+  _Atomic uint32_t producer_waiting;
+  void *items[SPSC_CAPACITY];
+} Spsc;
+
+void Spsc_init(Spsc *q) {
+  atomic_init(&q->head, 0);
+  atomic_init(&q->consumer_waiting, 0);
+  atomic_init(&q->tail, 0);
+  atomic_init(&q->producer_waiting, 0);
+}
+
+void Spsc_push(Spsc *q, void *item) {
+  uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  for (;;) {
+    uint32_t tail = atomic_load(&q->tail);
+    if (head - tail < SPSC_CAPACITY) {
+      break;
+    }
+    atomic_store(&q->producer_waiting, 1);
+    if (atomic_load(&q->tail) == tail) {
+      Futex_wait(&q->tail, tail);
+    }
+    atomic_store(&q->producer_waiting, 0);
+  }
+  q->items[head & (SPSC_CAPACITY - 1)] = item;
+  atomic_store(&q->head, head + 1);
+  if (atomic_load(&q->consumer_waiting)) {
+    Futex_wake(&q->head);
+  }
+}
+
+void *Spsc_pop(Spsc *q) {
+  uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  for (;;) {
+    uint32_t head = atomic_load(&q->head);
+    if (head != tail) {
+      break;
+    }
+    atomic_store(&q->consumer_waiting, 1);
+    if (atomic_load(&q->head) == head) {
+      Futex_wait(&q->head, head);
+    }
+    atomic_store(&q->consumer_waiting, 0);
+  }
+  void *item = q->items[tail & (SPSC_CAPACITY - 1)];
+  atomic_store(&q->tail, tail + 1);
+  if (atomic_load(&q->producer_waiting)) {
+    Futex_wake(&q->tail);
+  }
+  return item;
+}
+
+#endif
@@ -1,143 +1,287 @@
 #ifndef TapeDelay_LIB
 #define TapeDelay_LIB 1
 
-#include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "arena.h"
+#include "effect.h"
 #include "fixedpoint.h"
+#include "ringbuffer.h"
 #include "slew.h"
 
 typedef struct TapeDelay {
-  int32_t buffer[22000];  // Fixed circular buffer of 22000 samples
+  DelaySample buffer[22000];  // Fixed circular buffer of 22000 samples
   size_t buffer_size;     // Size of the circular buffer
   size_t write_index;     // Current write index
-  float delay_time;       // Delay time in samples (can be fractional)
-  float feedback;
+  int32_t delay_time;     // Q16.16 delay time in samples (can be fractional)
+  int32_t feedback;       // TAPEDELAY_Q_BITS fractional bits
+  // Q16.16 delay time the read position last glided to, kept across blocks
+  int32_t previous_delay_time;
+  unsigned int slew_steps;  // samples a parameter change glides over
   Slew feedback_slew;
   Slew delay_slew;
 } TapeDelay;
 
-TapeDelay *TapeDelay_malloc(float feedback, float delay_time) {
-  TapeDelay *tapeDelay = (TapeDelay *)malloc(sizeof(TapeDelay));
-  if (tapeDelay == NULL) {
-    return NULL;
-  }
+// default glide time of feedback and delay changes, 94230 samples
+#define TAPEDELAY_SLEW_MS 2136.7347f
+// samples per pass, the parameter ramps are generated a pass at a time
+#define TAPEDELAY_CHUNK 256
 
-  tapeDelay->delay_time = delay_time;
+// 0.01 samples, delay changes below this don't move the read position
+#define TAPEDELAY_GLIDE_THRESHOLD 655
+
+// fractional bits of the feedback, see FIXEDPOINT_Q_BITS
+#ifndef TAPEDELAY_Q_BITS
+#define TAPEDELAY_Q_BITS FIXEDPOINT_Q_BITS
+#endif
+
+static void TapeDelay_init(TapeDelay *tapeDelay, float feedback,
+                           float delay_time) {
+  tapeDelay->delay_time = q16_16_float_to_fp(delay_time);
   tapeDelay->buffer_size = 22000;  // Fixed buffer size
   tapeDelay->write_index = 0;
-  tapeDelay->feedback = feedback;
+  tapeDelay->feedback = q_float_to_fp(feedback, TAPEDELAY_Q_BITS);
+  tapeDelay->previous_delay_time = 0;
 
   // Initialize the buffer to zero
-  for (size_t i = 0; i < tapeDelay->buffer_size; i++) {
-    tapeDelay->buffer[i] = 0;
-  }
+  memset(tapeDelay->buffer, 0, sizeof(tapeDelay->buffer));
 
-  Slew_init(&tapeDelay->feedback_slew, 94230, 0);
-  Slew_set_target(&tapeDelay->feedback_slew, feedback, 94230);
-  Slew_init(&tapeDelay->delay_slew, 94230, 0);
-  Slew_set_target(&tapeDelay->delay_slew, delay_time, 94230);
+  tapeDelay->slew_steps =
+      Slew_ms_to_steps(TAPEDELAY_SLEW_MS, EFFECT_SAMPLE_RATE);
+  Slew_init(&tapeDelay->feedback_slew, 0);
+  Slew_set_target(&tapeDelay->feedback_slew, tapeDelay->feedback,
+                  tapeDelay->slew_steps);
+  Slew_init(&tapeDelay->delay_slew, 0);
+  Slew_set_target(&tapeDelay->delay_slew, tapeDelay->delay_time,
+                  tapeDelay->slew_steps);
+}
+
+TapeDelay *TapeDelay_alloc(Arena *arena, float feedback, float delay_time) {
+  TapeDelay *tapeDelay = (TapeDelay *)Arena_alloc(arena, sizeof(TapeDelay));
+  if (tapeDelay == NULL) {
+    return NULL;
+  }
+  TapeDelay_init(tapeDelay, feedback, delay_time);
+  return tapeDelay;
+}
 
+TapeDelay *TapeDelay_malloc(float feedback, float delay_time) {
+  TapeDelay *tapeDelay = (TapeDelay *)malloc(sizeof(TapeDelay));
+  if (tapeDelay == NULL) {
+    return NULL;
+  }
+  TapeDelay_init(tapeDelay, feedback, delay_time);
   return tapeDelay;
 }
 
 void TapeDelay_set_feedback(TapeDelay *tapeDelay, float feedback) {
-  tapeDelay->feedback = feedback;
-  Slew_set_target(&tapeDelay->feedback_slew, feedback, 94230);
+  tapeDelay->feedback = q_float_to_fp(feedback, TAPEDELAY_Q_BITS);
+  Slew_set_target(&tapeDelay->feedback_slew, tapeDelay->feedback,
+                  tapeDelay->slew_steps);
 }
 
 void TapeDelay_set_delay_time(TapeDelay *tapeDelay, float delay_time) {
-  tapeDelay->delay_time = delay_time;
-  Slew_set_target(&tapeDelay->delay_slew, delay_time, 94230);
+  tapeDelay->delay_time = q16_16_float_to_fp(delay_time);
+  Slew_set_target(&tapeDelay->delay_slew, tapeDelay->delay_time,
+                  tapeDelay->slew_steps);
 }
 
-// Linear interpolation helper
-static inline int32_t linear_interpolation(int32_t y1, int32_t y2, float frac) {
-  return y1 + (int32_t)((y2 - y1) * frac);
+// glide time for later feedback and delay changes
+void TapeDelay_set_slew_ms(TapeDelay *tapeDelay, float ms) {
+  tapeDelay->slew_steps = Slew_ms_to_steps(ms, EFFECT_SAMPLE_RATE);
 }
 
-// Soft clipping function
-static inline int32_t soft_clip(int32_t x, int32_t threshold) {
-  if (x > threshold) {
-    return threshold +
-           ((x - threshold) >> 3);  // Gradual saturation above threshold
-  } else if (x < -threshold) {
-    return -threshold +
-           ((x + threshold) >> 3);  // Gradual saturation below threshold
-  } else {
-    return x;  // No saturation within the threshold
-  }
+// Linear interpolation helper, frac is Q16.16 in [0, 1)
+static inline int32_t linear_interpolation(int32_t y1, int32_t y2,
+                                           int32_t frac) {
+  return y1 + (int32_t)(((int64_t)y2 - y1) * frac >> Q16_16_Q_BITS);
 }
 
-// Tanh-like saturation function
-static inline int32_t tanh_saturation(int32_t x) {
-  float normalized = x / (float)INT32_MAX;  // Normalize to range -1 to 1
-  float saturated = tanh(normalized);       // Apply tanh for smooth compression
-  return (int32_t)(saturated * INT32_MAX);  // Scale back to int32 range
+/*
+ * Fast tanh-like approximation, x * (27 + x^2) / (27 + 9 x^2) with x taken
+ * as a fraction of 2^31. Takes the wider sum so an overshooting feedback
+ * path saturates instead of wrapping; the curve reaches 1 at x = 3.
+ */
+static inline int32_t tanh_approx(int64_t x) {
+  const int64_t limit = (int64_t)3 << 31;
+  TELEMETRY_COUNT(clips, (x > limit) | (x < -limit));
+  if (x > limit) {
+    x = limit;
+  } else if (x < -limit) {
+    x = -limit;
+  }
+  int64_t n2 = ((x >> 8) * (x >> 8)) >> 30;  // x^2 in Q16
+  if (n2 == 0) {
+    return (int32_t)x;  // below -96 dB the curve is a straight line
+  }
+  int64_t y = x * ((27 << 16) + n2) / ((27 << 16) + 9 * n2);
+  TELEMETRY_COUNT(clips, TELEMETRY_WRAPS32(y));
+  if (y > INT32_MAX) {
+    return INT32_MAX;
+  }
+  if (y < INT32_MIN) {
+    return INT32_MIN;
+  }
+  return (int32_t)y;
 }
 
-// Fast tanh-like approximation
-static inline int32_t tanh_approx(int32_t x) {
-  float normalized = x / (float)INT32_MAX;  // Normalize to range -1 to 1
-  float saturated =
-      normalized * (27.0f + normalized * normalized) /
-      (27.0f + 9.0f * normalized * normalized);  // Polynomial approximation
-  return (int32_t)(saturated * INT32_MAX);       // Scale back to int32 range
+// one sample through the delay, previous_delay_time is updated on a glide
+static inline int32_t TapeDelay_tick(TapeDelay *tapeDelay, int32_t input,
+                                     int32_t feedback, int32_t delay_time,
+                                     int32_t *previous_delay_time) {
+  const int64_t buffer_length = (int64_t)tapeDelay->buffer_size
+                                << Q16_16_Q_BITS;
+
+  // Q16.16 read position behind the write head
+  int64_t read_index =
+      ((int64_t)tapeDelay->write_index << Q16_16_Q_BITS) - delay_time;
+
+  // Adjust the read position aggressively for pitchy artifacts when the
+  // delay time moves
+  int32_t change = delay_time - *previous_delay_time;
+  if (change > TAPEDELAY_GLIDE_THRESHOLD ||
+      change < -TAPEDELAY_GLIDE_THRESHOLD) {
+    read_index += change / 2;  // Emphasize pitch change
+    *previous_delay_time = delay_time;
+  }
+
+  if (read_index < 0) {
+    read_index += buffer_length;
+  } else if (read_index >= buffer_length) {
+    read_index -= buffer_length;
+  }
+
+  size_t base_read_index = (size_t)(read_index >> Q16_16_Q_BITS);
+  size_t next_read_index = base_read_index + 1;
+  if (next_read_index == tapeDelay->buffer_size) {
+    next_read_index = 0;
+  }
+  int32_t frac = (int32_t)(read_index & (Q16_16_1 - 1));
+
+  // Read the delayed sample with interpolation
+  int32_t delayed_sample =
+      linear_interpolation(DelaySample_load(tapeDelay->buffer[base_read_index]),
+                           DelaySample_load(tapeDelay->buffer[next_read_index]),
+                           frac);
+
+  // Add feedback to the current sample, saturate and write it to the
+  // buffer
+  int64_t sum =
+      (int64_t)input +
+      q_multiply_sat(feedback, delayed_sample, TAPEDELAY_Q_BITS);
+  int32_t processed_sample = tanh_approx(sum);
+
+  tapeDelay->buffer[tapeDelay->write_index] =
+      DelaySample_store(processed_sample);
+
+  // Update write index
+  if (++tapeDelay->write_index == tapeDelay->buffer_size) {
+    tapeDelay->write_index = 0;
+  }
+  return processed_sample;
 }
 
 void TapeDelay_process(TapeDelay *tapeDelay, int32_t *buf,
                        unsigned int nr_samples) {
-  float previous_delay_time =
-      Slew_process(&tapeDelay->delay_slew);  // Get initial delay time
-
-  for (unsigned int i = 0; i < nr_samples; i++) {
-    // Update feedback and delay time dynamically
-    int32_t feedback =
-        q16_16_float_to_fp(Slew_process(&tapeDelay->feedback_slew));
-    float delay_time = Slew_process(&tapeDelay->delay_slew);
-
-    // If delay time changes, introduce abrupt changes to fractional index
-    float fractional_read_index = (float)tapeDelay->write_index - delay_time;
-    if (fractional_read_index < 0) {
-      fractional_read_index += tapeDelay->buffer_size;
-    }
+  int32_t feedback[TAPEDELAY_CHUNK];
+  int32_t delay_time[TAPEDELAY_CHUNK];
+  int32_t previous_delay_time = tapeDelay->previous_delay_time;
 
-    // Adjust fractional read index aggressively for pitchy artifacts
-    if (fabs(delay_time - previous_delay_time) >
-        0.01f) {  // Threshold to detect significant change
-      fractional_read_index +=
-          (delay_time - previous_delay_time) * 0.5f;  // Emphasize pitch change
-      previous_delay_time = delay_time;
+  for (unsigned int i = 0; i < nr_samples; i += TAPEDELAY_CHUNK) {
+    unsigned int n = nr_samples - i;
+    if (n > TAPEDELAY_CHUNK) {
+      n = TAPEDELAY_CHUNK;
     }
+    // Update feedback and delay time a pass at a time
+    int feedback_settled =
+        Slew_process_block(&tapeDelay->feedback_slew, feedback, n);
+    int delay_settled =
+        Slew_process_block(&tapeDelay->delay_slew, delay_time, n);
 
-    size_t base_read_index =
-        (size_t)fractional_read_index % tapeDelay->buffer_size;
-    size_t next_read_index = (base_read_index + 1) % tapeDelay->buffer_size;
-    float frac = fractional_read_index - (size_t)fractional_read_index;
-
-    // Read the delayed sample with interpolation
-    int32_t delayed_sample =
-        linear_interpolation(tapeDelay->buffer[base_read_index],
-                             tapeDelay->buffer[next_read_index], frac);
-
-    // Add feedback to the current sample and write it to the buffer
-    int32_t input_sample = buf[i];
-    int32_t processed_sample =
-        input_sample + q16_16_multiply(feedback, delayed_sample);
+    if (feedback_settled && delay_settled) {
+      // constant parameters, the glide can only fire on the first sample
+      int32_t fb = Slew_value(&tapeDelay->feedback_slew);
+      int32_t dt = Slew_value(&tapeDelay->delay_slew);
+      for (unsigned int k = 0; k < n; k++) {
+        buf[i + k] = TapeDelay_tick(tapeDelay, buf[i + k], fb, dt,
+                                    &previous_delay_time);
+      }
+      continue;
+    }
+    if (feedback_settled) {
+      int32_t fb = Slew_value(&tapeDelay->feedback_slew);
+      for (unsigned int k = 0; k < n; k++) {
+        feedback[k] = fb;
+      }
+    }
+    if (delay_settled) {
+      int32_t dt = Slew_value(&tapeDelay->delay_slew);
+      for (unsigned int k = 0; k < n; k++) {
+        delay_time[k] = dt;
+      }
+    }
+    for (unsigned int k = 0; k < n; k++) {
+      buf[i + k] = TapeDelay_tick(tapeDelay, buf[i + k], feedback[k],
+                                  delay_time[k], &previous_delay_time);
+    }
+  }
 
-    // Apply tanh-like saturation to prevent harsh distortion
-    processed_sample = tanh_approx(processed_sample);
+  tapeDelay->previous_delay_time = previous_delay_time;
+}
 
-    tapeDelay->buffer[tapeDelay->write_index] = processed_sample;
+void TapeDelay_reset(TapeDelay *tapeDelay) {
+  memset(tapeDelay->buffer, 0, sizeof(tapeDelay->buffer));
+  tapeDelay->write_index = 0;
+  Slew_set_target(&tapeDelay->feedback_slew, tapeDelay->feedback, 0);
+  Slew_set_target(&tapeDelay->delay_slew, tapeDelay->delay_time, 0);
+  tapeDelay->previous_delay_time = tapeDelay->delay_time;
+}
 
-    // Update write index
-    tapeDelay->write_index =
-        (tapeDelay->write_index + 1) % tapeDelay->buffer_size;
+int TapeDelay_set_param(TapeDelay *tapeDelay, const char *param,
+                        float value) {
+  if (strcmp(param, "feedback") == 0) {
+    TapeDelay_set_feedback(tapeDelay, value);
+    return 0;
+  }
+  if (strcmp(param, "time") == 0 && value >= 1 &&
+      value < tapeDelay->buffer_size - 1) {
+    TapeDelay_set_delay_time(tapeDelay, value);
+    return 0;
+  }
+  if (strcmp(param, "slew") == 0 && value >= 0) {
+    TapeDelay_set_slew_ms(tapeDelay, value);
+    return 0;
+  }
+  return -1;
+}
 
-    // Store the processed sample back in the buffer
-    buf[i] = processed_sample;
+/*
+ * Every pass through the tape scales an input by at most the feedback, the
+ * saturation only takes away. Feedback at or above 1 never dies out.
+ */
+uint32_t TapeDelay_tail(TapeDelay *tapeDelay) {
+  int32_t current = Slew_value(&tapeDelay->feedback_slew);
+  int32_t target = (int32_t)(tapeDelay->feedback_slew.target >> 16);
+  if (current < 0) {
+    current = -current;
   }
+  if (target < 0) {
+    target = -target;
+  }
+  return Effect_feedback_tail((uint32_t)tapeDelay->buffer_size,
+                              current > target ? current : target,
+                              TAPEDELAY_Q_BITS, EFFECT_TAIL_BITS);
+}
+
+// moves the parameter glides and the tape position n samples ahead
+void TapeDelay_advance(TapeDelay *tapeDelay, uint32_t n) {
+  Slew_advance(&tapeDelay->feedback_slew, n);
+  Slew_advance(&tapeDelay->delay_slew, n);
+  // the read position follows a gliding delay time sample by sample
+  tapeDelay->previous_delay_time = Slew_value(&tapeDelay->delay_slew);
+  tapeDelay->write_index =
+      (tapeDelay->write_index + n) % tapeDelay->buffer_size;
 }
 
 void TapeDelay_free(TapeDelay *tapeDelay) {
@@ -146,4 +290,32 @@ void TapeDelay_free(TapeDelay *tapeDelay) {
   }
 }
 
+static void TapeDelay_effect_process(void *self, int32_t *buf,
+                                     unsigned int nr_samples) {
+  TapeDelay_process((TapeDelay *)self, buf, nr_samples);
+}
+
+static int TapeDelay_effect_set_param(void *self, const char *param,
+                                      float value) {
+  return TapeDelay_set_param((TapeDelay *)self, param, value);
+}
+
+static void TapeDelay_effect_reset(void *self) {
+  TapeDelay_reset((TapeDelay *)self);
+}
+
+static uint32_t TapeDelay_effect_tail(void *self) {
+  return TapeDelay_tail((TapeDelay *)self);
+}
+
+static void TapeDelay_effect_advance(void *self, uint32_t n) {
+  TapeDelay_advance((TapeDelay *)self, n);
+}
+
+const EffectOps TapeDelay_ops = {"tapedelay", TapeDelay_effect_process,
+                                 TapeDelay_effect_set_param,
+                                 TapeDelay_effect_reset,
+                                 TapeDelay_effect_tail,
+                                 TapeDelay_effect_advance};
+
 #endif
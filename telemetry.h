@@ -0,0 +1,88 @@
+#ifndef TELEMETRY_LIB
+#define TELEMETRY_LIB 1
+
+#include <stdint.h>
+
+// Overflow and clipping telemetry, compiled in with -DFPFX_TELEMETRY (see
+// `make telemetry`). The arithmetic counts into whatever counters the
+// running thread points Telemetry_current at, a chain points it at the
+// effect it is running. Counting is a compare and an add, no branches.
+// Without FPFX_TELEMETRY the macros are empty and the build is unchanged.
+
+// Q16.16 magnitude of a sample at int16 full scale
+#define TELEMETRY_FULL_SCALE ((uint32_t)32767 << 16)
+
+#ifdef FPFX_TELEMETRY
+
+#include <math.h>
+#include <stdio.h>
+
+typedef struct TelemetryCounters {
+  uint64_t overflows;  // sums and products that wrapped around 32 bits
+  uint64_t clips;      // values a saturating stage had to clamp
+  uint64_t rails;      // samples leaving the stage at full scale
+  uint32_t peak;       // largest Q16.16 magnitude leaving the stage
+  uint64_t blocks;     // blocks seen
+  uint64_t bad_blocks;  // blocks with an overflow or clip
+} TelemetryCounters;
+
+// counts made outside of any chain, e.g. the output conversion
+TelemetryCounters Telemetry_sink;
+__thread TelemetryCounters *Telemetry_current = &Telemetry_sink;
+
+#define TELEMETRY_COUNT(field, cond) \
+  (Telemetry_current->field += (uint64_t)(cond))
+
+#else
+
+#define TELEMETRY_COUNT(field, cond) ((void)0)
+
+#endif
+
+// a 64-bit result that does not survive the cast to int32
+#define TELEMETRY_WRAPS32(x) ((int64_t)(x) != (int64_t)(int32_t)(x))
+
+#ifdef FPFX_TELEMETRY
+
+static inline uint64_t Telemetry_events(const TelemetryCounters *t) {
+  return t->overflows + t->clips;
+}
+
+// peak and full scale samples of a block that left a stage
+static inline void Telemetry_scan(TelemetryCounters *t, const int32_t *buf,
+                                  unsigned int nr_samples) {
+  uint32_t peak = t->peak;
+  uint64_t rails = 0;
+  for (unsigned int i = 0; i < nr_samples; i++) {
+    int32_t sign = buf[i] >> 31;
+    uint32_t magnitude = ((uint32_t)buf[i] ^ sign) - sign;
+    peak = magnitude > peak ? magnitude : peak;
+    rails += magnitude >= TELEMETRY_FULL_SCALE;
+  }
+  t->peak = peak;
+  t->rails += rails;
+}
+
+void Telemetry_merge(TelemetryCounters *dst, const TelemetryCounters *src) {
+  dst->overflows += src->overflows;
+  dst->clips += src->clips;
+  dst->rails += src->rails;
+  dst->peak = src->peak > dst->peak ? src->peak : dst->peak;
+  dst->blocks += src->blocks;
+  dst->bad_blocks += src->bad_blocks;
+}
+
+void Telemetry_print(FILE *f, const char *name, const TelemetryCounters *t) {
+  // dBFS of the peak, -inf for silence
+  double peak = t->peak / (double)((uint32_t)32768 << 16);
+  fprintf(f,
+          "telemetry: %-10s peak %7.2f dBFS  overflows %llu  clips %llu  "
+          "at full scale %llu  blocks hit %llu/%llu\n",
+          name, 20 * log10(peak), (unsigned long long)t->overflows,
+          (unsigned long long)t->clips, (unsigned long long)t->rails,
+          (unsigned long long)t->bad_blocks, (unsigned long long)t->blocks);
+}
+
+#endif
+
+#endif
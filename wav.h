@@ -0,0 +1,227 @@
+#ifndef WAV_LIB
+#define WAV_LIB 1
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 16-bit PCM wav file, samples interleaved
+typedef struct Wav {
+  unsigned int sample_rate;
+  unsigned int channels;
+  unsigned int nr_frames;
+  int16_t *samples;
+} Wav;
+
+static inline uint32_t Wav_u32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint16_t Wav_u16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static inline void Wav_put_u32(uint8_t *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static inline void Wav_put_u16(uint8_t *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+/**
+ * Load a 16-bit PCM wav file.
+ * @return 0 on success, -1 if the file can't be read or isn't 16-bit PCM.
+ */
+int Wav_read(const char *path, Wav *wav) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return -1;
+  }
+  uint8_t header[12];
+  if (fread(header, 1, 12, f) != 12 || memcmp(header, "RIFF", 4) != 0 ||
+      memcmp(header + 8, "WAVE", 4) != 0) {
+    fclose(f);
+    return -1;
+  }
+
+  int have_fmt = 0;
+  uint8_t chunk[8];
+  while (fread(chunk, 1, 8, f) == 8) {
+    uint32_t size = Wav_u32(chunk + 4);
+    if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+      uint8_t fmt[16];
+      if (fread(fmt, 1, 16, f) != 16) {
+        break;
+      }
+      if (Wav_u16(fmt) != 1 || Wav_u16(fmt + 14) != 16) {
+        break;  // only 16-bit PCM
+      }
+      wav->channels = Wav_u16(fmt + 2);
+      wav->sample_rate = Wav_u32(fmt + 4);
+      have_fmt = 1;
+      fseek(f, size - 16 + (size & 1), SEEK_CUR);
+    } else if (memcmp(chunk, "data", 4) == 0 && have_fmt) {
+      wav->nr_frames = size / (2 * wav->channels);
+      wav->samples = (int16_t *)malloc((size_t)wav->nr_frames *
+                                       wav->channels * sizeof(int16_t));
+      if (wav->samples == NULL ||
+          fread(wav->samples, 2 * wav->channels, wav->nr_frames, f) !=
+              wav->nr_frames) {
+        free(wav->samples);
+        break;
+      }
+      fclose(f);
+      return 0;
+    } else {
+      fseek(f, size + (size & 1), SEEK_CUR);
+    }
+  }
+  fclose(f);
+  return -1;
+}
+
+void Wav_free(Wav *wav) {
+  free(wav->samples);
+  wav->samples = NULL;
+}
+
+/* Memory-mapped files. Samples are used in place, which assumes a
+   little-endian host like the rest of the code. */
+
+// canonical header written for new files, the data starts right after it
+#define WAV_HEADER_SIZE 44
+
+typedef struct WavMap {
+  Wav wav;  // samples point into the mapping
+  void *base;
+  size_t size;
+} WavMap;
+
+/**
+ * Parse a 16-bit PCM wav file held in memory, wav->samples points into it.
+ * A data chunk claiming more than is there (as streaming writers leave it)
+ * is cut to the bytes present.
+ * @return 0 on success, -1 if it isn't a 16-bit PCM wav file.
+ */
+int Wav_parse(const uint8_t *data, size_t size, Wav *wav) {
+  if (size < 12 || memcmp(data, "RIFF", 4) != 0 ||
+      memcmp(data + 8, "WAVE", 4) != 0) {
+    return -1;
+  }
+  int have_fmt = 0;
+  size_t pos = 12;
+  while (pos + 8 <= size) {
+    const uint8_t *chunk = data + pos;
+    size_t chunk_size = Wav_u32(chunk + 4);
+    pos += 8;
+    if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16 &&
+        pos + 16 <= size) {
+      if (Wav_u16(data + pos) != 1 || Wav_u16(data + pos + 14) != 16) {
+        return -1;  // only 16-bit PCM
+      }
+      wav->channels = Wav_u16(data + pos + 2);
+      wav->sample_rate = Wav_u32(data + pos + 4);
+      have_fmt = wav->channels > 0;
+    } else if (memcmp(chunk, "data", 4) == 0 && have_fmt) {
+      if (chunk_size > size - pos) {
+        chunk_size = size - pos;
+      }
+      wav->nr_frames = chunk_size / (2 * wav->channels);
+      wav->samples = (int16_t *)(data + pos);
+      return 0;
+    }
+    pos += chunk_size + (chunk_size & 1);
+  }
+  return -1;
+}
+
+/**
+ * Map a 16-bit PCM wav file read-only.
+ * @return 0 on success, -1 if it can't be mapped or isn't 16-bit PCM.
+ */
+int Wav_map(const char *path, WavMap *map) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 12) {
+    close(fd);
+    return -1;
+  }
+  map->size = st.st_size;
+  map->base = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map->base == MAP_FAILED) {
+    return -1;
+  }
+  if (Wav_parse((const uint8_t *)map->base, map->size, &map->wav) != 0) {
+    munmap(map->base, map->size);
+    return -1;
+  }
+  madvise(map->base, map->size, MADV_SEQUENTIAL);
+  return 0;
+}
+
+/**
+ * Create a 16-bit PCM wav file of nr_frames and map it for writing, the
+ * samples start out silent.
+ * @return 0 on success, -1 on error.
+ */
+int Wav_map_create(const char *path, unsigned int sample_rate,
+                   unsigned int channels, unsigned int nr_frames,
+                   WavMap *map) {
+  size_t data_size = (size_t)nr_frames * channels * sizeof(int16_t);
+  if (data_size > UINT32_MAX - WAV_HEADER_SIZE) {
+    return -1;  // too big for a RIFF file
+  }
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return -1;
+  }
+  map->size = WAV_HEADER_SIZE + data_size;
+  if (ftruncate(fd, map->size) != 0) {
+    close(fd);
+    return -1;
+  }
+  map->base =
+      mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map->base == MAP_FAILED) {
+    return -1;
+  }
+  uint8_t *h = (uint8_t *)map->base;
+  memcpy(h, "RIFF", 4);
+  Wav_put_u32(h + 4, map->size - 8);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  Wav_put_u32(h + 16, 16);
+  Wav_put_u16(h + 20, 1);  // PCM
+  Wav_put_u16(h + 22, channels);
+  Wav_put_u32(h + 24, sample_rate);
+  Wav_put_u32(h + 28, sample_rate * channels * 2);
+  Wav_put_u16(h + 32, channels * 2);
+  Wav_put_u16(h + 34, 16);
+  memcpy(h + 36, "data", 4);
+  Wav_put_u32(h + 40, data_size);
+  map->wav.sample_rate = sample_rate;
+  map->wav.channels = channels;
+  map->wav.nr_frames = nr_frames;
+  map->wav.samples = (int16_t *)(h + WAV_HEADER_SIZE);
+  return 0;
+}
+
+void Wav_unmap(WavMap *map) {
+  munmap(map->base, map->size);
+  map->base = NULL;
+  map->wav.samples = NULL;
+}
+
+#endif